@@ -1,24 +1,71 @@
 #ifndef TRE_H
 #define TRE_H
 
+#include <stdio.h>
+#include <stdint.h>
+
 // Basic safety restrictions
-#define TRE_DEFAULT_MAX_PATTERN_LENGTH     64    // Default max regex pattern length
+#define TRE_DEFAULT_MAX_PATTERN_LENGTH     64    // Sizes match()'s static scratch program
 #define TRE_DEFAULT_MAX_RECURSION_DEPTH   128    // Default max recursive calls
 #define TRE_DEFAULT_MAX_BACKTRACK_STEPS 20480    // Default max backtracking steps
+#define TRE_DEFAULT_MAX_PROGRAM_SIZE     4096    // Default max instructions in a compiled program
+
+// Self-tuning limits (see tre_tune_init)
+#define TRE_DEFAULT_TUNE_WARMUP          1000    // calls observed before limits are derived
+#define TRE_DEFAULT_TUNE_PERCENTILE        99    // percentile of the observed distribution
+#define TRE_DEFAULT_TUNE_HEADROOM         100    // extra percent added on top of the percentile
+#define TRE_TUNE_BUCKETS                   32    // log2 histogram buckets (covers any int)
+#define TRE_TUNE_MIN_STEPS                 64    // derived step limits never go below this
+#define TRE_TUNE_MIN_DEPTH                  8    // derived depth limits never go below this
 
 
 // Error codes (returned in tre_last_error when match() returns NULL)
 #define TRE_OK                        0
 #define TRE_ERROR_NO_MATCH            1   // normal "no match" (not really an error)
-#define TRE_ERROR_PATTERN_TOO_LONG    2
+#define TRE_ERROR_PATTERN_TOO_LONG    2   // also: program too large, or compile buffer too small
 #define TRE_ERROR_RECURSION_DEPTH     3
 #define TRE_ERROR_BACKTRACK_LIMIT     4
 #define TRE_ERROR_MALFORMED_PATTERN   5   // e.g. unbalanced { }, invalid escape, etc.
 
+// Compile flags (tre_compile)
+#define TRE_IGNCASE                   1   // case-insensitive (same as match()'s igncase = 1)
+#define TRE_DFA                       2   // also build the automaton for three-phase DFA search
+
+// Engines a compiled program runs on (tre_prog_engine)
+#define TRE_ENGINE_BACKTRACK          0   // recursive backtracker (always available)
+#define TRE_ENGINE_DFA                1   // forward/reverse automaton scan
+
+// Instruction sets for the scanning kernels (tre_simd_select)
+#define TRE_SIMD_AUTO                -1   // best the CPU supports, or $TRE_SIMD
+#define TRE_SIMD_SCALAR               0
+#define TRE_SIMD_SSE2                 1
+#define TRE_SIMD_AVX2                 2
+#define TRE_SIMD_AVX512               3   // AVX-512F + BW
+
+// Profiling (only collected when the library is built with -DTRE_PROFILE, see `make PROFILE=1`)
+#define TRE_PROFILE_MAX_PATTERN     256   // pattern positions tracked by the profiler
+#define TRE_TRACE_EXEC                0   // an atom was tried against the text
+#define TRE_TRACE_BACKTRACK           1   // a repetition of an atom was given back
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Compiled program (opaque; lives in a caller-supplied memory block)
+typedef struct tre_prog tre_prog_t;
+
+// Per-pattern self-tuning state, owned by the caller (one per pattern)
+typedef struct {
+    int warmup;                              // calls to observe before deriving limits
+    int percentile;                          // percentile of steps/depth to cover
+    int headroom;                            // extra percent on top of that percentile
+    int calls;                               // calls observed so far
+    int max_steps;                           // derived step limit  (0 = still warming up)
+    int max_depth;                           // derived depth limit (0 = still warming up)
+    unsigned int steps_hist[TRE_TUNE_BUCKETS];
+    unsigned int depth_hist[TRE_TUNE_BUCKETS];
+} tre_tune_t;
+
 /**
  * match - search for regexp anywhere in text (unless ^)
  *
@@ -38,37 +85,719 @@ extern "C" {
  * - Literals: abc, hello123
  * - Any character: .
  * - Character classes: [abc], [^0-9], [a-zA-Z0-9]
- * - Quantifiers: * (zero or more), + (one or more), ? (zero or one), {n} (exact repetition)
+ * - Shorthand classes: \d \w \s and their negations \D \W \S
+ * - Word boundaries: \b (boundary), \B (not a boundary), zero-width
+ * - Quantifiers: * (zero or more), + (one or more), ? (zero or one), {n} (exact repetition),
+ *   {n,} (at least n), {n,m} (n to m)
+ * - Lazy quantifiers: *?, +?, ??, {n,m}? stop at the first (shortest) acceptable end
  * - Anchors: ^ (start), $ (end)
  * - Escaping: \., \*, \+, \?, \[, \\, etc.
  * - Case-insensitive mode via igncase parameter
  *
  * Limitations:
- * - No non-greedy quantifiers (*?, +?, ??, {n}?)
  * - No alternation (|)
  * - No grouping ((...))
  * - No backreferences
  * - No lookahead/lookbehind
- * - Greedy quantifiers only
  */
 char* match(char *regexp, char *text, int *length, int igncase, int direction);
 
 // Reset the peak trackers to zero
 void tre_reset_peaks(void);
 
+/**
+ * tre_tune_init - (re)start learning the limits for one pattern
+ *
+ * @param tune        caller-owned tuning state
+ * @param warmup      number of calls to observe (<= 0: TRE_DEFAULT_TUNE_WARMUP)
+ * @param percentile  1..100, percentile of the observed steps/depth (<= 0: default)
+ * @param headroom    extra percent on top of that percentile (< 0: default)
+ */
+void tre_tune_init(tre_tune_t *tune, int warmup, int percentile, int headroom);
+
+/**
+ * tre_match_tuned - match() with limits learned for this pattern
+ *
+ * During the warm-up the global limits apply and the backtrack steps and
+ * recursion depth of every call are recorded. Afterwards the call is cut off at
+ * the learned limits (never above the global tre_max_* limits), so pathological
+ * inputs fail fast with TRE_ERROR_BACKTRACK_LIMIT / TRE_ERROR_RECURSION_DEPTH.
+ */
+char* tre_match_tuned(tre_tune_t *tune, char *regexp, char *text, int *length, int igncase, int direction);
+
+/**
+ * tre_compile_size - bytes of memory tre_compile() needs for regexp
+ *
+ * @return size in bytes, or -1 if the pattern is invalid (see tre_last_error)
+ */
+int tre_compile_size(const char *regexp, int flags);
+
+/**
+ * tre_compile - compile regexp into a program for repeated matching
+ *
+ * @param regexp   regular expression pattern (same syntax as match())
+ * @param flags    TRE_IGNCASE and/or TRE_DFA, or 0
+ * @param mem      caller-owned memory the program is stored in (no heap is used)
+ * @param memsize  size of mem, at least tre_compile_size(regexp, flags)
+ *
+ * @return the program (inside mem), or NULL with tre_last_error set
+ *
+ * The pattern text is not limited by tre_max_pattern_length; instead the
+ * program may hold at most tre_max_program_size instructions (one per atom).
+ * The program stays valid as long as mem does; no cleanup is needed.
+ */
+tre_prog_t* tre_compile(const char *regexp, int flags, void *mem, int memsize);
+
+// Literal keyword set, hashed by length group (tre_lits_init)
+#define TRE_LITS_BUCKETS              7   // hash window widths: 1, 2, 3, 4, 8, 16, 32
+typedef struct {
+    int       n;                 // keywords
+    int       nbuckets;          // window widths in use
+    int       window[TRE_LITS_BUCKETS];
+    uint32_t  pow[TRE_LITS_BUCKETS];
+    char     *bytes;             // keywords back to back
+    int      *off;               // keyword i is bytes[off[i] .. off[i + 1])
+    int      *next;              // next keyword with the same window hash, -1 = end
+    uint64_t *slots;             // hash table: window hash << 32 | first keyword + 1, 0 = empty
+    int       mask;
+    uint64_t *filter;            // two bits per key in one word, rejects most windows
+    int       fmask, fshift;
+    int       used;              // bytes of mem in use
+} tre_lits_t;
+
+/**
+ * Called by tre_lits_scan() for every keyword occurrence
+ *
+ * @return nonzero to stop scanning
+ */
+typedef int (*tre_lit_fn)(int keyword, const char *match, int matchlen, void *user);
+
+/**
+ * tre_lits_init - index a large set of literal keywords for tre_lits_scan()
+ *
+ * A multi-pattern Rabin-Karp index: keywords are grouped by length, and each
+ * group rolls a hash of a fixed window (the keyword length up to 4 bytes, then
+ * 4, 8, 16 or 32) along the text. Candidates are confirmed with memcmp. Memory is
+ * the keyword bytes plus about 22 bytes per keyword, so millions of keywords
+ * fit where an Aho-Corasick automaton would not.
+ *
+ * @param lens  keyword lengths, or NULL if NUL-terminated; keywords may not be empty
+ * @param mem   at least tre_lits_bytes() bytes; the index lives there
+ *
+ * @return 0, or -1 with tre_last_error set
+ */
+int tre_lits_init(tre_lits_t *lits, const char *const *keywords, const int *lens, int n, void *mem, int memsize);
+int tre_lits_bytes(const char *const *keywords, const int *lens, int n);   // -1 on an empty keyword
+
+/**
+ * tre_lits_scan - report every occurrence of every keyword in text
+ *
+ * Occurrences come in order of start position, shorter keywords first;
+ * overlapping and duplicate keywords are all reported. fn may be NULL to count.
+ *
+ * @return number of occurrences reported
+ */
+int tre_lits_scan(const tre_lits_t *lits, const char *text, int textlen, tre_lit_fn fn, void *user);
+
+// Pattern set compiled into one arena (tre_set_compile)
+#define TRE_SET_LITERAL_MIN        1024   // literal-only sets this large also get a tre_lits_t index
+#define TRE_SET_REDUCE                4   // tre_set_compile flag: run tre_set_reduce() and skip covered patterns
+#define TRE_SET_REDUCE_WORK   (64 * 1024)   // work memory tre_set_size() adds for TRE_SET_REDUCE
+typedef struct {
+    int n;                       // patterns
+    tre_prog_t **progs;          // progs[i] runs patterns[i]; identical patterns share one program
+    int failed;                  // index of the first pattern that did not compile, or -1
+    int used;                    // arena bytes the set occupies (the rest is free again)
+    int programs;                // distinct programs stored
+    int classes;                 // [...] class bitmaps referenced by the programs
+    int classes_stored;          // distinct class bitmaps stored
+    const tre_lits_t *lits;      // keyword index for tre_set_match(), or NULL
+    const char *literals;        // with lits: pattern i at literals + lits->off[i] + i, progs[i] NULL
+    int flags;                   // flags the patterns were compiled with
+    const int *covered_by;       // with TRE_SET_REDUCE: the kept pattern covering i, or -1 (else NULL)
+} tre_set_t;
+
+/**
+ * tre_set_compile - compile many patterns at once, in parallel, into one arena
+ *
+ * Patterns are measured and compiled by nthreads threads (libraries built with
+ * TRE_THREADS, the default; otherwise serially). Identical patterns share one
+ * program, and identical [...] class bitmaps are stored once for the whole set.
+ * Programs work exactly like ones from tre_compile().
+ *
+ * Sets of at least TRE_SET_LITERAL_MIN plain-text patterns (see tre_set_match)
+ * store only the patterns and a tre_lits_t index, so memory grows with the
+ * keyword bytes: progs[i] is NULL, and tre_set_prog() compiles one on demand.
+ *
+ * With TRE_SET_REDUCE in flags, tre_set_reduce() runs on the compiled set and
+ * set->covered_by keeps its answer in the arena. tre_set_match() then runs a
+ * covered pattern only on texts its covering pattern matched, so the reported
+ * bits are unchanged. Keyword sets ignore the flag (their index scans once).
+ *
+ * @param progs    caller array of n pointers, filled in
+ * @param mem      arena, at least tre_set_size() bytes; set->used of it stay in use
+ *
+ * @return 0, or -1 with tre_last_error set (and set->failed if a pattern is bad;
+ *         TRE_ERROR_PATTERN_TOO_LONG if the arena is too small)
+ */
+int tre_set_compile(tre_set_t *set, const char *const *patterns, int n, int flags,
+                    tre_prog_t **progs, void *mem, int memsize, int nthreads);
+
+// Arena bytes tre_set_compile() needs at most, -1 if a pattern is bad (see tre_last_error)
+int tre_set_size(const char *const *patterns, int n, int flags, int nthreads);
+
+/**
+ * tre_set_prog - the program for pattern i of a set
+ *
+ * Returns progs[i], or for keyword sets compiles pattern i into mem, which needs
+ * tre_set_prog_size() bytes (0 when the set already holds the program).
+ *
+ * @return the program, or NULL with tre_last_error set
+ */
+tre_prog_t *tre_set_prog(const tre_set_t *set, int i, void *mem, int memsize);
+int tre_set_prog_size(const tre_set_t *set, int i);
+
+/**
+ * tre_set_match - which patterns of a set match text
+ *
+ * Sets of at least TRE_SET_LITERAL_MIN patterns that are all plain text (none
+ * of \ ^ $ . [ * + ? { and no TRE_IGNCASE) are searched with their tre_lits_t
+ * index in one pass over text. Other sets run each program, except that
+ * with TRE_SET_REDUCE a covered pattern is only run if its cover matched.
+ *
+ * @param matched  [out] (set->n + 7) / 8 bytes, bit i set if pattern i matches
+ *
+ * @return number of patterns that match, or -1 with tre_last_error set (a
+ *         search cut off by a backtracking limit)
+ */
+int tre_set_match(const tre_set_t *set, const char *text, int textlen, unsigned char *matched);
+
+/**
+ * tre_subsumes - does every text a matches also match b?
+ *
+ * Walks the automata of both programs together over all texts (both may have at
+ * most 63 units, see TRE_DFA) looking for one that a matches and b does not.
+ * work is scratch memory; about 16 KiB plus 32 bytes per state explored.
+ *
+ * @return 1 if b subsumes a, 0 if not, -1 if undecided (too many units or
+ *         states for work)
+ */
+int tre_subsumes(const tre_prog_t *a, const tre_prog_t *b, void *work, int worksize);
+
+/**
+ * tre_set_reduce - find the patterns of a set that others make redundant
+ *
+ * subsumed_by[i] is set to a kept pattern j whose matches cover pattern i's
+ * (every record i matches, j matches too), or -1 if i is kept. Of equivalent
+ * patterns the first stays. Pairs are compared with tre_subsumes(), after a
+ * cheap byte filter, so the cost is quadratic in the worst case; undecided
+ * pairs keep both patterns. Keyword sets (no programs) compare the keywords
+ * directly: a keyword covers every keyword that contains it. Reporting only;
+ * tre_set_compile() applies it when given TRE_SET_REDUCE.
+ *
+ * @return number of patterns kept
+ */
+int tre_set_reduce(tre_set_t *set, int *subsumed_by, void *work, int worksize);
+
+// Boolean rule "P1 and P2 and not P3" over one text (tre_bool_init)
+#define TRE_BOOL_MAX                  8   // patterns per rule
+typedef struct {
+    int            n;                    // patterns added
+    tre_prog_t    *progs[TRE_BOOL_MAX];
+    unsigned char  negate[TRE_BOOL_MAX]; // 1 = the text must not match this one
+    const void    *dfa[TRE_BOOL_MAX];    // automaton in the product, NULL = searched on its own
+    unsigned char *mem;                  // automata built for the rule, then the state cache
+    int            memsize, used;
+    int            ready;                // state cache laid out for the current patterns
+    unsigned char  map[256];             // byte -> class of the product
+    int            nclass;
+    int            cap, nstates;         // state budget and states cached
+    int            flushes;              // times the cache filled up and was restarted
+    void          *states;
+    int           *trans, *slots;
+    int            nslots;
+} tre_bool_t;
+
+/**
+ * tre_bool_init / tre_bool_add / tre_bool_exec - match a conjunction in one pass
+ *
+ * The automata of all patterns are stepped together as one product automaton
+ * whose states are built lazily and cached in mem; mem bounds the number of
+ * states, and a full cache is simply restarted. The scan stops as soon as the
+ * outcome is known (a negated pattern matched, an anchored pattern can no longer
+ * match, or every pattern has decided it). Patterns with more than 63 units have
+ * no automaton and are searched on their own after the product says yes.
+ *
+ * @return tre_bool_add: 0, or -1 if the rule is full or mem is too small;
+ *         tre_bool_exec: 1 if the text satisfies the rule, 0 if not, -1 with
+ *         tre_last_error set
+ */
+int tre_bool_init(tre_bool_t *rule, void *mem, int memsize);
+int tre_bool_add(tre_bool_t *rule, tre_prog_t *prog, int negate);
+int tre_bool_exec(tre_bool_t *rule, const char *text, int textlen);
+
+/**
+ * tre_prog_engine - which engine tre_exec() uses for prog
+ *
+ * With TRE_DFA a search runs in three phases: a forward automaton scan finds
+ * the earliest match end, a reverse scan from there finds the leftmost start,
+ * and the match length comes from a forward scan anchored at that start (or
+ * from the backtracker if the pattern has lazy quantifiers). Each phase is
+ * linear in the text, so the backtracking limits do not apply. Patterns that
+ * expand to more than 63 units ({n,m} counts each repetition) stay on the
+ * backtracker; results are the same either way.
+ *
+ * @return TRE_ENGINE_DFA or TRE_ENGINE_BACKTRACK
+ */
+int tre_prog_engine(const tre_prog_t *prog);
+
+// Memory a compiled program occupies (tre_prog_footprint)
+typedef struct {
+    int hot;                     // 64-byte aligned block every search reads (the parts below + padding)
+    int header;                  //   program header
+    int inst;                    //   instructions
+    int dfa;                     //   automaton, 0 without TRE_DFA
+    int classes;                 //   class bitmaps (0 in a set: they live in its shared pool)
+    int cold;                    // pattern copy, kept apart from the hot block
+    int total;                   // bytes used in the caller's block, alignment included
+} tre_footprint_t;
+
+/**
+ * tre_prog_footprint - report how much memory prog uses, split hot and cold
+ *
+ * The header, instructions, automaton and class bitmaps are packed into one
+ * block starting on a cache line, so a search touches only hot->hot bytes.
+ * The pattern copy is placed after it (in a set, after all programs).
+ */
+void tre_prog_footprint(const tre_prog_t *prog, tre_footprint_t *fp);
+
+/**
+ * tre_exec / tre_execn - search text with a compiled program
+ *
+ * Same result as match(): pointer to the start of the match or NULL, with the
+ * length in *length and the reason in tre_last_error. tre_execn() searches
+ * exactly textlen bytes and does not need the text to be NUL-terminated.
+ */
+char* tre_exec(tre_prog_t *prog, const char *text, int *length, int direction);
+char* tre_execn(tre_prog_t *prog, const char *text, int textlen, int *length, int direction);
+
+/**
+ * tre_match_field - search one field of a delimited line (CSV, TSV, logs)
+ *
+ * Locates field number field (0 = first) by counting delimiters with the SIMD
+ * kernels, without splitting the line, and runs prog on just that span in
+ * place; ^ and $ anchor to the field. Quoting is not interpreted.
+ *
+ * @return start of the match inside line, or NULL (a line with fewer fields
+ *         does not match)
+ */
+char* tre_match_field(tre_prog_t *prog, const char *line, int linelen, char delim, int field, int *length);
+
+/**
+ * Called by tre_scan_lines() for every line whose field matches
+ *
+ * @param line     start of the line (without the newline)
+ * @param match    the match inside the field, matchlen bytes
+ * @return nonzero to stop scanning
+ */
+typedef int (*tre_line_fn)(const char *line, int linelen, const char *match, int matchlen, void *user);
+
+/**
+ * tre_scan_lines - batch tre_match_field() over a buffer of '\n'-separated lines
+ *
+ * A trailing '\r' is not part of the line. fn may be NULL to only count.
+ *
+ * @return number of matching lines, or -1 with tre_last_error set if a search
+ *         was cut off by a limit
+ */
+int tre_scan_lines(tre_prog_t *prog, const char *buf, int buflen, char delim, int field,
+                   tre_line_fn fn, void *user);
+
+// Read pipeline for tre_scan_files(): a pool of chunk buffers in caller memory
+typedef struct {
+    int        depth;       // reads kept in flight while a buffer is matched
+    int        chunk;       // bytes per read
+    int        overlap;     // longest partial line carried into the next chunk
+    int        sync;        // 1 = plain pread() even where io_uring is available
+    int        max_read;    // largest single read asked of the kernel, 0 = a whole chunk
+    void      *mem;
+    // filled in by tre_scan_files()
+    int        file;        // index of the file being matched (read it from fn)
+    int        files;       // files scanned
+    int        errors;      // paths that could not be opened or read
+    int        reads;       // chunks read
+    long long  bytes;       // bytes read
+    int        uring;       // 1 if io_uring carried the reads
+} tre_files_t;
+
+/**
+ * tre_files_init - set up the buffer pool for tre_scan_files()
+ *
+ * The pool holds depth + 1 buffers of chunk bytes plus room for a carried line
+ * of up to overlap bytes. Lines longer than that across a chunk boundary are
+ * searched as two lines.
+ *
+ * @return 0, or -1 if a size is out of range or mem is smaller than tre_files_bytes()
+ */
+int tre_files_init(tre_files_t *io, int depth, int chunk, int overlap, void *mem, int memsize);
+
+// Bytes of memory tre_files_init() needs, -1 for sizes out of range
+int tre_files_bytes(int depth, int chunk, int overlap);
+
+/**
+ * tre_scan_files - tre_scan_lines() over a set of files, reading ahead
+ *
+ * On Linux the reads go through io_uring (raw syscalls), so up to depth chunks
+ * are read by the kernel while the calling thread matches the oldest one; where
+ * io_uring is missing or refused it falls back to pread(). Files are scanned in
+ * order and fn sees each file's lines in order, with io->file telling which.
+ * Paths that cannot be opened are counted in io->errors and skipped.
+ *
+ * @return number of matching lines, or -1 with tre_last_error set if a search
+ *         was cut off by a limit
+ */
+int tre_scan_files(tre_prog_t *prog, tre_files_t *io, const char *const *paths, int npaths,
+                   char delim, int field, tre_line_fn fn, void *user);
+
+// Sampled estimate of the matching lines in a large buffer (tre_estimate_lines)
+typedef struct {
+    int        block;       // bytes per sampled block (default 64 KiB)
+    double     z;           // interval half-width in standard errors (default 1.96, 95%)
+    double     target;      // keep sampling until half-width <= target * estimate (0: one round)
+    int        min_blocks;  // blocks in the first round (default 32)
+    long long  max_blocks;  // sampling budget, 0 = up to every block
+    uint64_t   seed;        // picks which blocks are sampled
+    // filled in by tre_estimate_lines()
+    double     estimate;    // estimated matching lines
+    double     low, high;   // confidence interval
+    long long  blocks;      // blocks in the buffer
+    long long  sampled;     // blocks scanned
+    long long  hits;        // matching lines in those blocks
+    int        exact;       // 1 if every block was scanned (estimate is the count)
+} tre_estimate_t;
+
+// Defaults for every setting, with the given error target and seed
+void tre_estimate_init(tre_estimate_t *est, double target, uint64_t seed);
+
+/**
+ * tre_estimate_lines - roughly how many lines match, without reading them all
+ *
+ * Splits buf into blocks and scans a random sample of them like tre_scan_lines(),
+ * then scales the per-block counts up to the whole buffer. Sampling goes in
+ * rounds that double the sample until the confidence interval is within the
+ * target (relative to the estimate), the budget is used up, or every block has
+ * been scanned. Blocks are sampled without replacement, so the interval narrows
+ * to the exact count as the sample approaches the whole buffer.
+ *
+ * @return 0 with the results in est, or -1 with tre_last_error set
+ */
+int tre_estimate_lines(tre_prog_t *prog, const char *buf, long long buflen, char delim, int field,
+                       tre_estimate_t *est);
+
+// Byte-presence signature of a text (tre_sig_init), bit c = byte c occurs
+typedef struct {
+    uint64_t bits[4];
+} tre_sig_t;
+
+#define TRE_SIG_SETS                  3   // byte sets per program checked by tre_sig_reject()
+
+/**
+ * tre_sig_init / tre_sig_reject - cheap rejection when testing many patterns
+ *
+ * tre_sig_init() records which of the 256 byte values occur in the text; do it
+ * once per record. Every compiled program summarizes the bytes its matches must
+ * contain (each literal, and up to TRE_SIG_SETS of the rarest classes), so
+ * tre_sig_reject() can rule it out with a few ANDs before any search runs.
+ *
+ * @return 1 if prog cannot match the text the signature was made from, 0 if it
+ *         might (then run tre_execn as usual)
+ */
+void tre_sig_init(tre_sig_t *sig, const char *text, int textlen);
+int  tre_sig_reject(const tre_prog_t *prog, const tre_sig_t *sig);
+
+/**
+ * tre_match_dict - filter a dictionary-encoded string column
+ *
+ * Searches each distinct value once, then turns the row codes into a selection
+ * bitmap with gathers from the per-value results, so the cost is ndict searches
+ * plus a table lookup per row.
+ *
+ * @param prog       compiled pattern (forward search, match anywhere unless ^)
+ * @param dict       the distinct values
+ * @param lens       their lengths, or NULL if the values are NUL-terminated
+ * @param codes      one dictionary index per row, 0 <= code < ndict
+ * @param hits       scratch for ndict ints (per-value result)
+ * @param selection  [out] (ncodes + 7) / 8 bytes, bit i set if row i matches
+ *
+ * @return number of rows selected, or -1 with tre_last_error set (a code out of
+ *         range, or a value cut off by a backtracking limit)
+ */
+int tre_match_dict(tre_prog_t *prog, const char *const *dict, const int *lens, int ndict,
+                   const int *codes, int ncodes, int *hits, unsigned char *selection);
+
+/**
+ * tre_match_batch - search many short strings (tokens, codes, ids) at once
+ *
+ * Strings of up to 16 bytes are taken 64 at a time and transposed into columns,
+ * so the SIMD kernels check the minimum match length, the start byte and the
+ * bytes every match contains for 16/32/64 strings per instruction. Only the
+ * strings that pass are searched. Longer strings are searched directly.
+ *
+ * @param prog       compiled pattern (forward search, match anywhere unless ^)
+ * @param strs       the strings
+ * @param lens       their lengths, or NULL if the strings are NUL-terminated
+ * @param selection  [out] (n + 7) / 8 bytes, bit i set if strs[i] matches
+ *
+ * @return number of matching strings, or -1 with tre_last_error set (a search
+ *         cut off by a backtracking limit)
+ */
+int tre_match_batch(tre_prog_t *prog, const char *const *strs, const int *lens, int n, unsigned char *selection);
+
+// A text and its ASCII-lowercased copy, shared by all case-insensitive searches
+typedef struct {
+    const char *text;       // original text
+    char       *folded;     // lowercased copy (caller's buffer), NUL-terminated
+    int         len;
+} tre_fold_t;
+
+/**
+ * tre_fold_init / tre_exec_folded - fold a text once for many TRE_IGNCASE programs
+ *
+ * tre_fold_init() lowercases A-Z of text into buf (len + 1 bytes) with the
+ * vector kernels chosen by tre_simd_select(). tre_exec_folded() then runs
+ * TRE_IGNCASE programs on the copy as if case-sensitive, and other programs
+ * on the original, so one view serves a mixed rule set. Folding is ASCII
+ * only, like tolower() in the C locale.
+ *
+ * @return pointer into view->text (not the copy), as tre_execn() would
+ */
+void  tre_fold_init(tre_fold_t *view, const char *text, int len, char *buf);
+char* tre_exec_folded(tre_prog_t *prog, const tre_fold_t *view, int *length, int direction);
+
+/**
+ * tre_simd_select - choose the kernels that scan text for match start bytes
+ *
+ * All variants are built into the library; by default the best one the CPU
+ * supports is picked on first use. The environment variable TRE_SIMD
+ * (scalar, sse2, avx2, avx512) overrides that choice for TRE_SIMD_AUTO.
+ *
+ * @param level  TRE_SIMD_* level, or TRE_SIMD_AUTO
+ * @return the level in effect (never above what the CPU supports)
+ */
+int tre_simd_select(int level);
+
+// Level currently in effect (chooses it first if needed)
+int tre_simd_level(void);
+
+// Attach self-tuning state to a program (NULL detaches), see tre_tune_init()
+void tre_prog_tune(tre_prog_t *prog, tre_tune_t *tune);
+
+/**
+ * tre_find_all - call fn for every non-overlapping match, left to right
+ *
+ * Each search resumes right after the previous match (one byte further after an
+ * empty match); \b and \B still see the byte before the resume point. fn returns
+ * nonzero to stop. The match pointer points into text.
+ *
+ * @return number of matches, or -1 with tre_last_error set if a search was cut off
+ */
+typedef int (*tre_span_fn)(const char *match, int matchlen, void *user);
+int tre_find_all(tre_prog_t *prog, const char *text, int textlen, tre_span_fn fn, void *user);
+
+/**
+ * tre_find_next - one step of tre_find_all(), for callers that iterate themselves
+ *
+ * Searches text from offset *pos on, with the whole text as context for \b,
+ * and moves *pos past the match (one byte further after an empty match). Start
+ * with *pos = 0 and call until it returns NULL. The caller holds all the state.
+ *
+ * @return the match, or NULL when there are no more (tre_last_error is
+ *         TRE_ERROR_NO_MATCH, or a limit if the search was cut off)
+ */
+char* tre_find_next(tre_prog_t *prog, const char *text, int textlen, int *pos, int *length);
+
+// One top-K counter: the key is a 64-bit hash of the span, str/len point at the first span seen
+typedef struct {
+    uint64_t    key;
+    const char *str;            // into the text it came from (not copied)
+    int         len;
+    long long   count;          // never below the true count
+    long long   error;          // count - error is never above it
+} tre_topk_item_t;
+
+// Space-Saving top-K sketch in caller memory (tre_topk_init)
+typedef struct {
+    int              k, n;      // capacity, counters in use
+    tre_topk_item_t *items;
+    int             *heap;      // min-heap of item ids on count
+    int             *pos;       // heap position of each item
+    int             *slots;     // open-addressing index key -> item id
+    int              nslots;
+} tre_topk_t;
+
+/**
+ * tre_topk_init - heavy hitters among match spans, in k counters
+ *
+ * Space-Saving: a new key takes over the smallest counter and inherits its count
+ * as error, so every span seen more than total/k times is kept. Spans are not
+ * copied; item str pointers stay valid as long as the texts do.
+ *
+ * @return 0, or -1 if mem is smaller than tre_topk_bytes(k)
+ */
+int  tre_topk_init(tre_topk_t *topk, int k, void *mem, int memsize);
+int  tre_topk_bytes(int k);
+void tre_topk_add(tre_topk_t *topk, const char *str, int len);
+// Fold src into dst (e.g. one sketch per thread); the error bounds still hold
+void tre_topk_merge(tre_topk_t *dst, const tre_topk_t *src);
+// Copy the counters into out (k entries), largest count first; returns how many
+int  tre_topk_sorted(const tre_topk_t *topk, tre_topk_item_t *out);
+
+// HyperLogLog distinct counter: 2^TRE_HLL_BITS one-byte registers, about 1% standard error
+#define TRE_HLL_BITS                 14
+typedef struct {
+    unsigned char reg[1 << TRE_HLL_BITS];
+} tre_hll_t;
+
+void   tre_hll_init(tre_hll_t *hll);
+void   tre_hll_add(tre_hll_t *hll, const char *str, int len);
+void   tre_hll_merge(tre_hll_t *dst, const tre_hll_t *src);   // register-wise max
+double tre_hll_count(const tre_hll_t *hll);
+
+/**
+ * tre_aggregate - tre_find_all() feeding a top-K sketch and/or a distinct counter
+ *
+ * Each match span is hashed once, in place, and the hash goes to both. Either
+ * may be NULL. Sketches from different threads or texts combine with
+ * tre_topk_merge() / tre_hll_merge().
+ *
+ * @return number of matches, or -1 with tre_last_error set
+ */
+int tre_aggregate(tre_prog_t *prog, const char *text, int textlen, tre_topk_t *topk, tre_hll_t *hll);
+
+// Result cache for repeated identical inputs (see tre_cache_init)
+#define TRE_CACHE_WAYS                4   // entries per set; the clock hand sweeps a set
+
+typedef struct {
+    int nsets;                   // power of two, TRE_CACHE_WAYS entries each
+    unsigned int hand;           // clock hand (way the next eviction starts at)
+    unsigned long hits, misses, evictions;
+    void *slots;                 // entries, inside the caller's memory
+    uint64_t seed[2];            // secret hash keys, drawn by tre_cache_init()
+} tre_cache_t;
+
+/**
+ * tre_cache_init - set up a result cache in caller-owned memory
+ *
+ * A program with a cache attached (tre_prog_cache) first hashes the input text
+ * and returns the stored result (match offset, length, no-match) on a hit.
+ * Only completed searches are stored, never ones cut off by a limit. Texts are
+ * not kept: an entry is a 64-bit hash plus the text length and direction, and a
+ * hit must also agree on a second 64-bit hash. Both hashes are keyed with seeds
+ * drawn at init (from /dev/urandom where available), so colliding inputs cannot
+ * be prepared offline. A hit is still probabilistic rather than a comparison of
+ * the text: where even a chance collision is unacceptable, don't attach a
+ * cache. When a set is full, the clock hand evicts the first entry not used
+ * since its last pass.
+ *
+ * @param cache    cache state, owned by the caller
+ * @param mem      memory for the entries (at least tre_cache_bytes(1))
+ * @param memsize  size of mem; rounded down to a power of two number of sets
+ *
+ * @return number of entries, 0 if mem is too small
+ */
+int tre_cache_init(tre_cache_t *cache, void *mem, int memsize);
+
+// Bytes of memory for a cache of at least entries entries
+int tre_cache_bytes(int entries);
+
+// Drop all entries and statistics
+void tre_cache_clear(tre_cache_t *cache);
+
+// Attach a result cache to a program (NULL detaches); one cache per program
+void tre_prog_cache(tre_prog_t *prog, tre_cache_t *cache);
+
+// Shadow execution: compare a TRE_DFA program against the backtracker on live calls
+#define TRE_SHADOW_LOG                8   // divergences kept (most recent)
+#define TRE_SHADOW_TEXT              64   // bytes of input kept per divergence
+
+typedef struct {
+    const char *pattern;         // the program's pattern
+    char text[TRE_SHADOW_TEXT + 1];   // input, truncated, NUL-terminated
+    int textlen;                 // full input length
+    int direction;
+    int legacy_offset, legacy_length;   // backtracker (offset -1 = no match)
+    int new_offset, new_length;         // program's engine
+} tre_shadow_diff_t;
+
+typedef struct {
+    int sample_every;            // compare 1 in sample_every calls (0 = off)
+    unsigned long calls;         // calls seen
+    unsigned long sampled;       // calls run on both engines
+    unsigned long legacy_cutoff; // sampled calls the backtracker gave up on (not compared)
+    unsigned long divergences;   // sampled calls with a different start or length
+    unsigned long long legacy_ns, new_ns;   // time spent by each engine on sampled calls
+    tre_shadow_diff_t log[TRE_SHADOW_LOG];  // divergences, log[divergences % TRE_SHADOW_LOG] is next
+} tre_shadow_t;
+
+/**
+ * tre_shadow_init - set up shadow execution for rolling out a new engine
+ *
+ * With the shadow attached (tre_prog_shadow), every sample_every-th call of a
+ * TRE_DFA program also runs the legacy backtracker on the same input, compares
+ * the match start and length, logs divergences and times both engines. The
+ * caller always gets the program's own result; tre_shadow_dump() prints the
+ * report.
+ */
+void tre_shadow_init(tre_shadow_t *shadow, int sample_every);
+
+// Attach shadow execution to a program (NULL detaches)
+void tre_prog_shadow(tre_prog_t *prog, tre_shadow_t *shadow);
+
+// Print sampling counts, relative latency and the logged divergences
+void tre_shadow_dump(const tre_shadow_t *shadow, FILE *out);
+
+/**
+ * Trace callback, called for every profiled step when built with TRE_PROFILE
+ *
+ * @param event    TRE_TRACE_EXEC or TRE_TRACE_BACKTRACK
+ * @param pos      offset of the atom in the pattern
+ * @param text     current position in the input text
+ * @param user     tre_trace_user
+ */
+typedef void (*tre_trace_fn)(int event, int pos, const char *text, void *user);
+
+// Clear the per-position heat counters
+void tre_profile_reset(void);
+
+// Print the profiled pattern, one atom per line, annotated with its heat counts
+void tre_profile_dump(FILE *out);
+
 #ifdef __cplusplus
 }
 #endif
 
 // Global configuration variables (for single-threaded use)
 // Set these before calling match() to configure behavior
-extern int tre_max_pattern_length;   // Max pattern length     (default: TRE_DEFAULT_MAX_PATTERN_LENGTH)
+extern int tre_max_pattern_length;   // Unused: match() is bounded by tre_max_program_size too
 extern int tre_max_depth;            // Max recursion depth    (default: TRE_DEFAULT_MAX_RECURSION_DEPTH)
 extern int tre_max_backtrack_steps;  // Max backtracking steps (default: TRE_DEFAULT_MAX_BACKTRACK_STEPS)
+extern int tre_max_program_size;     // Max compiled instructions (default: TRE_DEFAULT_MAX_PROGRAM_SIZE)
 extern int tre_last_error;
 
 // Global high-water mark trackers (persistent until tre_reset_peaks() is called)
 extern int tre_peak_backtrack;     // highest backtrack steps seen in any match() so far
 extern int tre_peak_recursion;     // deepest recursion level reached in any match() so far
+extern int tre_peak_stack;         // most stack bytes used by any match() so far (TRE_STACKMETER builds)
+extern int tre_last_stack;         // stack bytes used by the last match() (TRE_STACKMETER builds)
+
+// Profiler state (TRE_PROFILE builds; counters are per pattern position, and per
+// instruction index in the program, and are reset automatically when a different
+// pattern is matched)
+extern unsigned long tre_prof_exec[TRE_PROFILE_MAX_PATTERN];            // atom attempts
+extern unsigned long tre_prof_backtrack[TRE_PROFILE_MAX_PATTERN];       // repetitions given back
+extern unsigned long tre_prof_inst_exec[TRE_PROFILE_MAX_PATTERN];       // atom attempts, by instruction
+extern unsigned long tre_prof_inst_backtrack[TRE_PROFILE_MAX_PATTERN];  // repetitions given back, by instruction
+extern tre_trace_fn  tre_trace_hook;   // optional per-step callback (NULL = off)
+extern void         *tre_trace_user;   // passed through to tre_trace_hook
 
 #endif /* TRE_H */
@@ -0,0 +1,328 @@
+// TinyRE C++ interface: programs owned by RAII objects, std::string_view inputs
+// searched in place (no NUL terminator, no copies), and a lazy range of matches.
+//
+//   tre::regex re("status=5\\d\\d", TRE_DFA);
+//   if (re.test(line)) ...
+//   if (auto m = re.find(line)) use(*m);             // std::string_view into line
+//   for (std::string_view m : re.matches(text)) ...  // no allocation per match
+//
+// Header-only over libtre.a. Needs C++17; with C++20 the match range is a
+// std::ranges::view and composes with the standard range adaptors, and
+// tre::stream_matches() scans asynchronous input from a coroutine.
+
+#ifndef TRE_HPP
+#define TRE_HPP
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <vector>
+#define TRE_HPP_COROUTINES 1
+#endif
+
+#include "tre.h"
+
+namespace tre {
+
+// A pattern that does not compile, or a search cut off by a limit
+class error : public std::runtime_error {
+public:
+    explicit error(int code) : std::runtime_error(describe(code)), code_(code) {}
+    int code() const noexcept { return code_; }   // TRE_ERROR_*
+
+private:
+    static const char *describe(int code) {
+        switch (code) {
+            case TRE_ERROR_PATTERN_TOO_LONG:  return "tre: pattern or text too long";
+            case TRE_ERROR_RECURSION_DEPTH:   return "tre: recursion depth limit";
+            case TRE_ERROR_BACKTRACK_LIMIT:   return "tre: backtracking limit";
+            case TRE_ERROR_MALFORMED_PATTERN: return "tre: malformed pattern";
+            default:                          return "tre: error";
+        }
+    }
+    int code_;
+};
+
+namespace detail {
+    // The C API takes int lengths
+    inline int length(std::string_view text) {
+        if (text.size() > static_cast<std::size_t>(INT_MAX)) throw error(TRE_ERROR_PATTERN_TOO_LONG);
+        return static_cast<int>(text.size());
+    }
+    inline const char *data(std::string_view text) { return text.data() ? text.data() : ""; }
+}
+
+// Input iterator over the non-overlapping matches in a text (see tre_find_next)
+class match_iterator {
+public:
+    using value_type        = std::string_view;
+    using reference         = std::string_view;
+    using pointer           = const std::string_view *;
+    using difference_type   = std::ptrdiff_t;
+    using iterator_category = std::input_iterator_tag;
+
+    match_iterator() = default;                        // end
+    match_iterator(tre_prog_t *prog, std::string_view text)
+        : prog_(prog), text_(detail::data(text)), len_(detail::length(text)) { next(); }
+
+    std::string_view operator*() const noexcept { return match_; }
+    pointer operator->() const noexcept { return &match_; }
+    match_iterator &operator++() { next(); return *this; }
+    match_iterator operator++(int) { match_iterator old = *this; next(); return old; }
+
+    // Iterators are equal when both are exhausted, or both at the same match
+    friend bool operator==(const match_iterator &a, const match_iterator &b) noexcept {
+        return a.prog_ == b.prog_ && (!a.prog_ || a.match_.data() == b.match_.data());
+    }
+    friend bool operator!=(const match_iterator &a, const match_iterator &b) noexcept { return !(a == b); }
+
+private:
+    // Throws tre::error if the search is cut off by a limit
+    void next() {
+        int len = 0;
+        const char *m = tre_find_next(prog_, text_, len_, &pos_, &len);
+        if (m) { match_ = std::string_view(m, static_cast<std::size_t>(len)); return; }
+        prog_ = nullptr;
+        if (tre_last_error != TRE_ERROR_NO_MATCH) throw error(tre_last_error);
+    }
+
+    tre_prog_t      *prog_ = nullptr;                  // nullptr once exhausted
+    const char      *text_ = nullptr;
+    int              len_  = 0;
+    int              pos_  = 0;                        // where the next search starts
+    std::string_view match_;
+};
+
+// The matches of one program in one text; iterating searches lazily
+class match_range
+#if __cplusplus >= 202002L
+    : public std::ranges::view_interface<match_range>
+#endif
+{
+public:
+    match_range() = default;
+    match_range(tre_prog_t *prog, std::string_view text) : prog_(prog), text_(text) {}
+
+    match_iterator begin() const { return match_iterator(prog_, text_); }
+    match_iterator end() const noexcept { return match_iterator(); }
+
+private:
+    tre_prog_t      *prog_ = nullptr;
+    std::string_view text_;
+};
+
+/**
+ * regex - a compiled pattern that owns its program
+ *
+ * Move-only. Compiling allocates the program block once; searching never
+ * allocates. Texts are std::string_view and are searched in place. Like the C
+ * API, searches share per-thread-unsafe globals (limits, tre_last_error).
+ */
+class regex {
+public:
+    // Throws tre::error if the pattern does not compile
+    explicit regex(std::string_view pattern, int flags = 0) {
+        const std::string source(pattern);             // tre_compile() needs a terminator
+        int size = tre_compile_size(source.c_str(), flags);
+        if (size < 0) throw error(tre_last_error);
+        mem_.reset(new unsigned char[static_cast<std::size_t>(size)]);
+        prog_ = tre_compile(source.c_str(), flags, mem_.get(), size);
+        if (!prog_) throw error(tre_last_error);
+    }
+
+    regex(regex &&other) noexcept
+        : mem_(std::move(other.mem_)), prog_(std::exchange(other.prog_, nullptr)) {}
+    regex &operator=(regex &&other) noexcept {
+        mem_ = std::move(other.mem_);
+        prog_ = std::exchange(other.prog_, nullptr);
+        return *this;
+    }
+    regex(const regex &) = delete;
+    regex &operator=(const regex &) = delete;
+
+    // Does text contain a match?
+    bool test(std::string_view text) const { return find(text).has_value(); }
+
+    // Leftmost match, as a view into text; std::nullopt if none.
+    // Throws tre::error if the search is cut off by a limit.
+    std::optional<std::string_view> find(std::string_view text) const {
+        int len = 0;
+        const char *m = tre_execn(prog_, detail::data(text), detail::length(text), &len, 1);
+        if (!m) {
+            if (tre_last_error != TRE_ERROR_NO_MATCH) throw error(tre_last_error);
+            return std::nullopt;
+        }
+        return std::string_view(m, static_cast<std::size_t>(len));
+    }
+
+    // Every non-overlapping match, left to right; text must outlive the range.
+    // Iterating throws tre::error if a search is cut off by a limit.
+    match_range matches(std::string_view text) const { return match_range(prog_, text); }
+
+    tre_prog_t *get() const noexcept { return prog_; }             // for the C API
+    int engine() const noexcept { return tre_prog_engine(prog_); }  // TRE_ENGINE_*
+
+private:
+    std::unique_ptr<unsigned char[]> mem_;
+    tre_prog_t *prog_ = nullptr;
+};
+
+#ifdef TRE_HPP_COROUTINES
+
+/**
+ * async_generator - a coroutine that co_yields values to an awaiting consumer
+ *
+ * Lazy: the body runs only while the consumer awaits next(), and may itself
+ * co_await (for input). next() gives a pointer to the yielded value, valid until
+ * the following next(), or nullptr once the body has finished. An exception
+ * thrown by the body comes out of next(). Control passes by symmetric transfer,
+ * so no thread or scheduler is involved.
+ *
+ *   while (const tre::match_event *ev = co_await gen.next()) ...
+ */
+template <typename T>
+class async_generator {
+public:
+    struct promise_type;
+    using handle = std::coroutine_handle<promise_type>;
+
+    // Suspends the body and resumes whoever awaits next()
+    struct to_consumer {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(handle h) const noexcept { return h.promise().consumer; }
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        const T                 *value = nullptr;
+        std::coroutine_handle<>  consumer;
+        std::exception_ptr       error;
+
+        async_generator get_return_object() noexcept { return async_generator(handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        to_consumer final_suspend() const noexcept { return {}; }
+        to_consumer yield_value(const T &v) noexcept { value = &v; return {}; }
+        void return_void() noexcept { value = nullptr; }
+        void unhandled_exception() noexcept { value = nullptr; error = std::current_exception(); }
+    };
+
+    struct next_awaiter {
+        handle h;
+        bool await_ready() const noexcept { return !h || h.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) const noexcept {
+            h.promise().consumer = consumer;
+            return h;
+        }
+        const T *await_resume() const {
+            if (!h || h.done()) {
+                if (h && h.promise().error) std::rethrow_exception(std::exchange(h.promise().error, nullptr));
+                return nullptr;
+            }
+            return h.promise().value;
+        }
+    };
+
+    async_generator(async_generator &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    async_generator &operator=(async_generator &&other) noexcept {
+        if (this != &other) { if (h_) h_.destroy(); h_ = std::exchange(other.h_, nullptr); }
+        return *this;
+    }
+    async_generator(const async_generator &) = delete;
+    async_generator &operator=(const async_generator &) = delete;
+    ~async_generator() { if (h_) h_.destroy(); }
+
+    // Run the body to its next co_yield (or its end)
+    next_awaiter next() const noexcept { return next_awaiter{h_}; }
+
+private:
+    explicit async_generator(handle h) noexcept : h_(h) {}
+    handle h_;
+};
+
+// One match in a stream: offset counts from the first byte of the input
+struct match_event {
+    std::uint64_t    offset;
+    std::string_view text;      // valid until the generator is resumed
+};
+
+/**
+ * stream_matches - the matches of re in input read chunk by chunk
+ *
+ * source.next() must return an awaitable that yields the next chunk as
+ * something convertible to std::string_view, empty at the end of the input.
+ * The chunk is copied before the next read, so it only has to stay valid until
+ * the generator resumes. re and source must outlive the generator.
+ *
+ * Matches are reported once they are settled: a match is final when at least
+ * lookback bytes, plus one, follow its start (or the input has ended), so
+ * lookback must be at least the longest match the pattern can produce. Only
+ * those bytes are carried between chunks (plus one byte of context for \b), so
+ * memory stays at one chunk plus lookback. Offsets and matches are those
+ * tre_find_next() finds over the whole input; ^ matches only at offset 0.
+ *
+ * Throws tre::error from next() if a search is cut off by a limit.
+ */
+template <typename Source>
+async_generator<match_event> stream_matches(const regex &re, Source &source, std::size_t lookback) {
+    std::vector<char> buf;          // [context byte] carried bytes, then the new chunk
+    std::uint64_t base = 0;         // stream offset of buf[0]
+    int start = 0;                  // where searching resumes in buf (1 after the context byte)
+
+    for (;;) {
+        std::string_view chunk = co_await source.next();
+        const bool last = chunk.empty();
+        buf.insert(buf.end(), chunk.begin(), chunk.end());
+        const int len = detail::length(std::string_view(buf.data(), buf.size()));
+        const char *text = detail::data(std::string_view(buf.data(), buf.size()));
+
+        // A match starting before limit cannot change with more input
+        const std::size_t limit = last ? buf.size() + 1
+                                : buf.size() > lookback ? buf.size() - lookback : 0;
+        int pos = start;
+        for (;;) {
+            int at = pos, mlen = 0;
+            const char *m = tre_find_next(re.get(), text, len, &at, &mlen);
+            if (!m) {
+                if (tre_last_error != TRE_ERROR_NO_MATCH) throw error(tre_last_error);
+                break;
+            }
+            const std::size_t s = static_cast<std::size_t>(m - text);
+            if (s >= limit) break;
+            pos = at;
+            match_event ev{base + s, std::string_view(m, static_cast<std::size_t>(mlen))};
+            co_yield ev;
+        }
+        if (last) co_return;
+
+        // Keep the unsettled tail, and the byte before it for \b
+        std::size_t keep = static_cast<std::size_t>(pos) > limit ? static_cast<std::size_t>(pos) : limit;
+        std::size_t ctx = keep > 0 ? 1 : 0;
+        buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(keep - ctx));
+        base += keep - ctx;
+        start = static_cast<int>(ctx);
+    }
+}
+
+#endif /* TRE_HPP_COROUTINES */
+
+} // namespace tre
+
+#if __cplusplus >= 202002L
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<tre::match_range> = true;   // matches point into the text
+#endif
+
+#endif /* TRE_HPP */
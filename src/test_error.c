@@ -98,7 +98,7 @@ int main(void) {
         tre_max_depth = 20;              // tiny for deep recursion
         if (i == 3) tre_max_depth = 5;
         tre_max_backtrack_steps = 512;   // tiny for backtracking
-        tre_max_pattern_length = 50;
+        tre_max_program_size = 50;       // one instruction per atom
 
         char *result = match(t->pattern, t->text, &length, t->igncase, 1);
 
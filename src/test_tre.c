@@ -1,6 +1,8 @@
 /* Comprehensive test suite for the TinyRE engine */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "tre.h"   // regex API
 
@@ -122,8 +124,655 @@ test_t tests[] = {
     { OK,  "a*$",          "aaa",           3,  0 },
     { NOK, "a*$",          "",              0,  0 },
     { NOK, "[a-z]+$",      "hello!",        0,  0 },
+
+    // ───────────────────────────────────────────────
+    // 11. Shorthand classes and word boundaries
+    // ───────────────────────────────────────────────
+    { OK,  "\\d+",        "abc123",        3,  0 },
+    { NOK, "\\d",         "d",             0,  0 },
+    { OK,  "\\D+",        "ab1",           2,  0 },
+    { OK,  "\\w+",        "  foo_9!",      5,  0 },
+    { OK,  "\\W",         "ab-c",          1,  0 },
+    { OK,  "a\\sb",       "a\tb",          3,  0 },
+    { OK,  "\\S+",        "  xy ",         2,  0 },
+    { OK,  "\\W",         "\xe9",          1,  1 },
+    { OK,  "^\\d{3}-\\d{4}$", "555-1234",   8,  0 },
+    { OK,  "\\bcat\\b",   "a cat!",        3,  0 },
+    { NOK, "\\bcat\\b",   "concatenate",   0,  0 },
+    { OK,  "\\Bcat",      "concat",        3,  0 },
+    { OK,  "\\w+\\b",     "hello world",   5,  0 },
+    { OK,  "\\b",         "a",             0,  0 },
+    { NOK, "\\b",         "",              0,  0 },
+
+    // ───────────────────────────────────────────────
+    // 12. Counted repetition and lazy quantifiers
+    // ───────────────────────────────────────────────
+    { OK,  "a{2,4}",       "aaaaa",         4,  0 },
+    { OK,  "a{2,}",        "aaaaa",         5,  0 },
+    { NOK, "a{2,4}",       "a",             0,  0 },
+    { OK,  "x{0,2}y",      "xxy",           3,  0 },
+    { NOK, "a{3,1}",       "aaa",           0,  0 },
+    { OK,  "<.*>",         "<a><b>",        6,  0 },
+    { OK,  "<.*?>",        "<a><b>",        3,  0 },
+    { OK,  "key=.*?;",     "key=a;b;",      6,  0 },
+    { OK,  "a+?",          "aaa",           1,  0 },
+    { OK,  "a*?b",         "aaab",          4,  0 },
+    { OK,  "ab??",         "ab",            1,  0 },
+    { OK,  "a{2,4}?",      "aaaaa",         2,  0 },
+    { OK,  "a{3}?",        "aaaaa",         3,  0 },
+    { OK,  "\\d{2,3}?-",   "1234-",         4,  0 },
+    { NOK, "<.+?>",        "<>",            0,  0 },
 };
 
+// ───────────────────────────────────────────────
+// API checks beyond plain match()
+// ───────────────────────────────────────────────
+static size_t api_total = 0, api_passed = 0;
+
+static void check(int ok, const char *what) {
+    api_total++;
+    if (ok) api_passed++;
+    printf("[%s] api  %s\n", ok ? "PASS" : "FAIL", what);
+}
+
+// tre_scan_files() callbacks: every hit is a 503 line of the file being matched
+static int file_line_hit(const char *line, int linelen, const char *m, int mlen, void *user) {
+    const tre_files_t *io = user;
+    if (mlen != 3 || memcmp(m, "503", 3) != 0 || line + linelen != m + mlen || (io->file != 0 && io->file != 3)) {
+        printf("       tre_scan_files: bad hit in file %d: %.*s\n", io->file, linelen, line);
+        exit(1);
+    }
+    return 0;
+}
+
+static int file_line_stop(const char *line, int linelen, const char *m, int mlen, void *user) {
+    (void)line; (void)linelen; (void)m; (void)mlen; (void)user;
+    return 1;
+}
+
+// tre_lits_scan() callback: record keyword and offset
+typedef struct {
+    int n;
+    int *keyword, *at;
+    const char *text;
+} lits_hits_t;
+
+static int on_lit(int keyword, const char *match, int matchlen, void *user) {
+    lits_hits_t *h = user;
+    (void)matchlen;
+    h->keyword[h->n] = keyword;
+    h->at[h->n++] = (int)(match - h->text);
+    return h->n == 16;
+}
+
+static void api_tests(void) {
+    tre_tune_t tune;
+    int length;
+
+    // Learn "a+a+b" on short inputs, then a long input without 'b' is cut off early
+    tre_tune_init(&tune, 10, 99, 100);
+    for (int i = 0; i < 10; i++)
+        tre_match_tuned(&tune, "a+a+b", "xaaab", &length, 0, 1);
+    check(tune.max_steps > 0 && tune.max_steps < tre_max_backtrack_steps, "tuned limit derived after warm-up");
+    check(tre_match_tuned(&tune, "a+a+b", "xaaab", &length, 0, 1) && length == 4, "tuned match still succeeds");
+    check(!tre_match_tuned(&tune, "a+a+b", "aaaaaaaaaaaaaaaaaaaa", &length, 0, 1)
+          && tre_last_error == TRE_ERROR_BACKTRACK_LIMIT, "pathological input cut off at tuned limit");
+    // Warm-up history in the top bucket: the derived limit clamps to the global one
+    tre_tune_init(&tune, 2, 100, 1000000);
+    tune.calls = 1;
+    tune.steps_hist[TRE_TUNE_BUCKETS - 1] = tune.depth_hist[TRE_TUNE_BUCKETS - 1] = 1;
+    tre_match_tuned(&tune, "a+a+b", "xaaab", &length, 0, 1);
+    check(tune.max_steps == tre_max_backtrack_steps && tune.max_depth == tre_max_depth, "tuned limit from the top bucket clamps");
+    check(!match("a+a+b", "aaaaaaaaaaaaaaaaaaaa", &length, 0, 1)
+          && tre_last_error == TRE_ERROR_NO_MATCH, "global limit left untouched");
+
+    // Compiled programs: long generated patterns, length-delimited text
+    static unsigned char mem[64 * 1024];
+    static char big[4096];
+    strcpy(big, "^");
+    for (int i = 0; i < 500; i++) strcat(big, "[a-z]x?");   // x? still needs an x to look at
+    tre_prog_t *prog = tre_compile(big, 0, mem, sizeof(mem));
+    check(prog != NULL && tre_compile_size(big, 0) <= (int)sizeof(mem), "compile 3500-char pattern");
+    char *text = malloc(1201);
+    for (int i = 0; i < 1200; i++) text[i] = (i & 1) ? 'x' : 'q';
+    text[1200] = '\0';
+    tre_max_depth = 1000;
+    check(prog && tre_exec(prog, text, &length, 1) == text && length == 1000, "match 1000-atom program");
+    check(prog && !tre_execn(prog, text, 999, &length, 1), "tre_execn stops at textlen");
+    tre_max_depth = TRE_DEFAULT_MAX_RECURSION_DEPTH;
+    free(text);
+
+    prog = tre_compile("b+c", TRE_IGNCASE, mem, sizeof(mem));
+    check(prog && tre_execn(prog, "aBBCd", 5, &length, 1) && length == 3, "tre_execn case-insensitive");
+    check(!tre_compile("abc", 0, mem, 8) && tre_last_error == TRE_ERROR_PATTERN_TOO_LONG, "compile buffer too small");
+    tre_max_program_size = 2;
+    check(!tre_compile("abc", 0, mem, sizeof(mem)) && tre_last_error == TRE_ERROR_PATTERN_TOO_LONG, "program size limit");
+    tre_max_program_size = TRE_DEFAULT_MAX_PROGRAM_SIZE;
+    check(!tre_compile("a[bc", 0, mem, sizeof(mem)) && tre_last_error == TRE_ERROR_MALFORMED_PATTERN, "unterminated class");
+
+    // match() is limited by program size, like tre_compile(), and grows past its scratch
+    tre_max_depth = 1000;
+    for (int i = 0; i < 300; i++) big[i] = (char)('a' + i % 26);
+    big[300] = '\0';
+    check(match(big, big, &length, 0, 1) == big && length == 300, "match() 300-char pattern");
+    big[200] = '\0';
+    check(match(big, big, &length, 1, 1) == big && length == 200, "match() recompiles after a long pattern");
+    tre_max_program_size = 100;
+    check(!match(big, big, &length, 0, 1) && tre_last_error == TRE_ERROR_PATTERN_TOO_LONG, "match() program size limit");
+    tre_max_program_size = TRE_DEFAULT_MAX_PROGRAM_SIZE;
+    check(!match("x[ab", "y", &length, 0, 1) && tre_last_error == TRE_ERROR_MALFORMED_PATTERN, "match() reports a malformed pattern before searching");
+    tre_max_depth = TRE_DEFAULT_MAX_RECURSION_DEPTH;
+
+    // DFA programs find the same matches as the backtracker, in both directions
+    int agree = 1;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        test_t *t = &tests[i];
+        for (int dir = -1; dir <= 1; dir += 2) {
+            int len1 = -1, len2 = -1;
+            char *r1 = match(t->pattern, t->text, &len1, t->igncase, dir);
+            if (tre_last_error > TRE_ERROR_NO_MATCH) continue;   // limits don't apply to the DFA
+            prog = tre_compile(t->pattern, TRE_DFA | (t->igncase ? TRE_IGNCASE : 0), mem, sizeof(mem));
+            if (!prog) continue;                                 // pattern too long for match() as well
+            char *r2 = tre_exec(prog, t->text, &len2, dir);
+            if (r1 != r2 || len1 != len2) {
+                printf("       dfa differs: %s on \"%s\" dir=%d\n", t->pattern, t->text, dir);
+                agree = 0;
+            }
+        }
+    }
+    check(agree, "DFA agrees with backtracker on the table");
+
+    prog = tre_compile("a*a*a*a*a*a*a*a*b", TRE_DFA, mem, sizeof(mem));
+    text = malloc(5001);
+    memset(text, 'a', 5000);
+    text[5000] = '\0';
+    check(prog && tre_prog_engine(prog) == TRE_ENGINE_DFA && !tre_exec(prog, text, &length, 1)
+          && tre_last_error == TRE_ERROR_NO_MATCH, "DFA: no backtracking blow-up");
+    text[4000] = 'b';
+    check(prog && tre_exec(prog, text, &length, 1) == text && length == 4001, "DFA: leftmost-longest on long run");
+    free(text);
+    prog = tre_compile("x\\w+?y", TRE_DFA, mem, sizeof(mem));
+    check(prog && tre_exec(prog, "ax12yy", &length, 1) && length == 4, "DFA: lazy length via backtracker");
+    prog = tre_compile("a{1,100}", TRE_DFA, mem, sizeof(mem));
+    check(prog && tre_prog_engine(prog) == TRE_ENGINE_BACKTRACK && tre_exec(prog, "baa", &length, 1) && length == 2,
+          "DFA: too many units falls back to backtracker");
+
+    // Every scanning kernel finds the same start bytes, at any offset and in the tail
+    static unsigned char mem2[4096];
+    tre_prog_t *bytes = tre_compile("Q[0-9]", TRE_IGNCASE, mem, sizeof(mem));
+    tre_prog_t *set = tre_compile("[^a-p]+", TRE_DFA, mem2, sizeof(mem2));
+    text = malloc(301);
+    int same = (bytes && set);
+    for (int level = TRE_SIMD_SCALAR; level <= TRE_SIMD_AVX512; level++) {
+        tre_simd_select(level);
+        for (int at = 0; at < 300 && same; at++) {
+            memset(text, 'a', 300);
+            text[at] = 'q';
+            text[at + 1] = (at + 1 < 300) ? '7' : '\0';
+            text[300] = '\0';
+            char *r1 = tre_exec(bytes, text, &length, 1);
+            same = (at + 1 < 300) ? (r1 == text + at && length == 2) : (r1 == NULL);
+            text[at] = 'z';
+            same = same && tre_exec(set, text, &length, 1) == text + at && length == 1 + (at + 1 < 300);
+        }
+    }
+    free(text);
+    check(same, "scan kernels agree at every offset");
+    check(tre_simd_select(TRE_SIMD_AVX512 + 1) <= TRE_SIMD_AVX512 && tre_simd_select(TRE_SIMD_SCALAR) == TRE_SIMD_SCALAR,
+          "tre_simd_select clamps to supported levels");
+    tre_simd_select(TRE_SIMD_AUTO);
+
+    // Result cache: repeated inputs are answered from the cache, cut-off searches never are
+    static unsigned char slots[1024];
+    tre_cache_t cache;
+    int entries = tre_cache_init(&cache, slots, sizeof(slots));
+    prog = tre_compile("[a-z]+\\.com", 0, mem, sizeof(mem));
+    tre_prog_cache(prog, &cache);
+    char *host = "www.example.com";
+    char *r1 = tre_exec(prog, host, &length, 1);
+    char *r2 = tre_exec(prog, host, &length, 1);
+    check(entries > 0 && r1 == host + 4 && r2 == r1 && length == 11 && cache.hits == 1 && cache.misses == 1,
+          "cache hit returns the stored match");
+    check(!tre_exec(prog, "example.org", &length, 1) && !tre_exec(prog, "example.org", &length, 1)
+          && tre_last_error == TRE_ERROR_NO_MATCH && cache.hits == 2, "cache stores no-match results");
+    tre_cache_t other;
+    static unsigned char other_slots[256];
+    tre_cache_init(&other, other_slots, sizeof(other_slots));
+    check(other.seed[0] != cache.seed[0] && other.seed[1] != cache.seed[1], "each cache draws its own hash keys");
+    cache.seed[1] ^= 1;          // same key, different confirming hash: must not be served
+    unsigned long hits = cache.hits;
+    check(tre_exec(prog, host, &length, 1) == host + 4 && cache.hits == hits, "cache hit needs the second hash too");
+    char names[64][sizeof "h-2147483648.com"];
+    for (int i = 0; i < 64; i++) {
+        snprintf(names[i], sizeof(names[i]), "h%d.com", i);
+        tre_exec(prog, names[i], &length, 1);
+    }
+    check(cache.evictions >= (unsigned long)(64 + 2 - entries), "cache evicts when full");
+    prog = tre_compile("a+a+b", 0, mem, sizeof(mem));
+    tre_prog_cache(prog, &cache);
+    tre_max_backtrack_steps = 16;
+    tre_exec(prog, "aaaaaaaaaaaaaaaaaaaa", &length, 1);
+    tre_max_backtrack_steps = TRE_DEFAULT_MAX_BACKTRACK_STEPS;
+    check(!tre_exec(prog, "aaaaaaaaaaaaaaaaaaaa", &length, 1) && tre_last_error == TRE_ERROR_NO_MATCH,
+          "cache skips searches cut off by a limit");
+
+    // Dictionary-encoded column: every kernel selects the same rows
+    const char *const dict[] = { "Mozilla/5.0", "curl/8.1", "Wget/1.21", "python-requests/2.31" };
+    static int codes[1003], dict_hits[4];
+    static unsigned char selection[(1003 + 7) / 8];
+    int expect = 0, rows_ok = 1;
+    for (int i = 0; i < 1003; i++) {
+        codes[i] = (i * 7 + i / 3) % 4;
+        expect += (codes[i] != 3);          // "python-requests" has a - in its name
+    }
+    prog = tre_compile("^\\w+/\\d+\\.\\d+$", 0, mem, sizeof(mem));
+    for (int level = TRE_SIMD_SCALAR; level <= TRE_SIMD_AVX512; level++) {
+        tre_simd_select(level);
+        rows_ok = rows_ok && tre_match_dict(prog, dict, NULL, 4, codes, 1003, dict_hits, selection) == expect;
+        for (int i = 0; i < 1003; i++)
+            rows_ok = rows_ok && ((selection[i >> 3] >> (i & 7)) & 1) == (codes[i] != 3);
+    }
+    tre_simd_select(TRE_SIMD_AUTO);
+    check(rows_ok, "tre_match_dict selects matching rows");
+    codes[500] = 4;
+    check(tre_match_dict(prog, dict, NULL, 4, codes, 1003, dict_hits, selection) == -1
+          && tre_last_error == TRE_ERROR_MALFORMED_PATTERN, "tre_match_dict rejects out-of-range codes");
+
+    // Short strings in batches: every kernel's column filter agrees with tre_execn()
+    const char *const tokens[] = { "US", "DE", "status=500", "status=404", "ID-4711", "ID-x", "", "GB",
+                                   "a much longer token than sixteen bytes status=503", "5", "ID-0042", "fr" };
+    static const char *batch[150];
+    static unsigned char batch_sel[(150 + 7) / 8];
+    const char *batch_pats[] = { "status=5\\d\\d", "^ID-\\d+$", "^[A-Z]{2}$", "x*" };
+    int batch_ok = 1;
+    for (int i = 0; i < 150; i++) batch[i] = tokens[(i * 5 + i / 7) % 12];
+    for (int p = 0; p < 4; p++) {
+        prog = tre_compile(batch_pats[p], 0, mem, sizeof(mem));
+        for (int level = TRE_SIMD_SCALAR; level <= TRE_SIMD_AVX512; level++) {
+            tre_simd_select(level);
+            int n = tre_match_batch(prog, batch, NULL, 150, batch_sel), want = 0;
+            for (int i = 0; i < 150; i++) {
+                int hit = tre_execn(prog, batch[i], (int)strlen(batch[i]), NULL, 1) != NULL;
+                want += hit;
+                batch_ok = batch_ok && ((batch_sel[i >> 3] >> (i & 7)) & 1) == hit;
+            }
+            batch_ok = batch_ok && n == want && (p != 1 || n > 0);
+        }
+    }
+    tre_simd_select(TRE_SIMD_AUTO);
+    check(batch_ok, "tre_match_batch selects like one search per string");
+
+    // Folded view: every kernel lowercases like tolower(), igncase searches map back
+    static char raw[300], folded[301];
+    tre_fold_t view;
+    int fold_ok = 1;
+    for (int i = 0; i < 300; i++) raw[i] = (char)(i * 37 + 11);
+    for (int level = TRE_SIMD_SCALAR; level <= TRE_SIMD_AVX512; level++) {
+        tre_simd_select(level);
+        tre_fold_init(&view, raw, 300, folded);
+        for (int i = 0; i < 300; i++)
+            fold_ok = fold_ok && folded[i] == (char)tolower((unsigned char)raw[i]);
+    }
+    tre_simd_select(TRE_SIMD_AUTO);
+    check(fold_ok && folded[300] == '\0', "tre_fold_init lowercases A-Z only");
+    const char *hdr = "Host: WWW.Example.COM\r\nUser-Agent: CURL/8.1";
+    tre_fold_init(&view, hdr, (int)strlen(hdr), folded);
+    int flen;
+    tre_prog_t *p_ic = tre_compile("example\\.[A-Z]+", TRE_IGNCASE, mem, sizeof(mem));
+    char *hit = tre_exec_folded(p_ic, &view, &flen, 1);
+    check(hit == hdr + 10 && flen == 11, "tre_exec_folded maps igncase match back to the text");
+    p_ic = tre_compile("Curl/\\d", TRE_IGNCASE | TRE_DFA, mem, sizeof(mem));
+    check(tre_exec_folded(p_ic, &view, &flen, 1) == hdr + 35 && flen == 6, "tre_exec_folded runs DFA programs");
+    p_ic = tre_compile("CURL", 0, mem, sizeof(mem));
+    check(tre_exec_folded(p_ic, &view, &flen, 1) == hdr + 35
+          && !tre_exec_folded(tre_compile("curl", 0, mem, sizeof(mem)), &view, &flen, 1),
+          "case-sensitive programs search the original text");
+
+    // Byte-presence signatures rule out patterns whose required bytes are missing
+    static unsigned char mem3[4096];
+    tre_sig_t sig;
+    const char *rec = "GET /index.html HTTP/1.1";
+    tre_sig_init(&sig, rec, (int)strlen(rec));
+    tre_prog_t *p_ok  = tre_compile("GET /\\w+\\.html?", 0, mem, sizeof(mem));
+    tre_prog_t *p_lit = tre_compile("POST", 0, mem2, sizeof(mem2));
+    tre_prog_t *p_cls = tre_compile("z*[0-9]{3}", 0, mem3, sizeof(mem3));   // 1 is present, z is not
+    check(p_ok && !tre_sig_reject(p_ok, &sig) && p_lit && tre_sig_reject(p_lit, &sig)
+          && p_cls && tre_sig_reject(p_cls, &sig), "signature rejects missing literals and classes");
+    p_cls = tre_compile("[p-z]+/[0-9]", TRE_IGNCASE, mem3, sizeof(mem3));
+    check(p_cls && !tre_sig_reject(p_cls, &sig) && tre_exec(p_cls, rec, &length, 1), "signature keeps possible matches");
+
+    // Shadow execution: sampled calls run on both engines and agree
+    tre_shadow_t shadow;
+    tre_shadow_init(&shadow, 2);
+    prog = tre_compile("\\b\\w+@\\w+\\.com", TRE_DFA, mem, sizeof(mem));
+    tre_prog_shadow(prog, &shadow);
+    for (int i = 0; i < 10; i++) {
+        char *r = tre_exec(prog, (i & 1) ? "mail bob@example.com now" : "no address", &length, 1);
+        if ((i & 1) && !(r && length == 15)) shadow.divergences += 100;   // own result must be unaffected
+    }
+    check(shadow.calls == 10 && shadow.sampled == 5 && shadow.divergences == 0, "shadow samples calls, engines agree");
+    prog = tre_compile("a*a*a*a*a*a*a*a*b", TRE_DFA, mem, sizeof(mem));
+    tre_shadow_init(&shadow, 1);
+    tre_prog_shadow(prog, &shadow);
+    check(!tre_exec(prog, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", &length, 1) && tre_last_error == TRE_ERROR_NO_MATCH
+          && shadow.legacy_cutoff == 1 && shadow.divergences == 0, "shadow skips comparison when legacy is cut off");
+
+    // Divergence: a tuned step limit cuts off the new engine's lazy match, legacy finds it
+    tre_tune_t tight;
+    prog = tre_compile("a+?b", TRE_DFA, mem, sizeof(mem));
+    tre_shadow_init(&shadow, 1);
+    tre_prog_shadow(prog, &shadow);
+    tre_tune_init(&tight, 1, 99, 0);
+    tight.max_steps = tight.max_depth = 1;
+    tre_prog_tune(prog, &tight);
+    check(!tre_exec(prog, "xaaaab", &length, 1) && tre_last_error == TRE_ERROR_BACKTRACK_LIMIT
+          && shadow.divergences == 1 && shadow.legacy_cutoff == 0, "shadow logs a divergence");
+    const tre_shadow_diff_t *dv = &shadow.log[0];
+    check(strcmp(dv->pattern, "a+?b") == 0 && strcmp(dv->text, "xaaaab") == 0 && dv->textlen == 6 && dv->direction == 1
+          && dv->legacy_offset == 1 && dv->legacy_length == 5 && dv->new_offset == -1 && dv->new_length == 0,
+          "shadow divergence record");
+    char report[512] = "";
+    FILE *dump = tmpfile();
+    if (dump) {
+        tre_shadow_dump(&shadow, dump);
+        rewind(dump);
+        report[fread(report, 1, sizeof(report) - 1, dump)] = '\0';
+        fclose(dump);
+    }
+    check(strstr(report, "shadow: 1 calls, 1 sampled, 1 compared, 1 diverged, 0 legacy cut off\n")
+          && strstr(report, "  a+?b on \"xaaaab\" (dir 1): legacy 1+5, new -1+0\n"), "shadow dump lists the divergence");
+
+    // Stack meter: deeper recursion uses more stack
+    tre_reset_peaks();
+    match("a+b", "aab", &length, 0, 1);
+    int shallow = tre_last_stack;
+    match("a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?", "aaaaaaaaaaaaaaaaaaaaaa", &length, 0, 1);
+    int deep = tre_last_stack;
+#ifdef TRE_STACKMETER
+    check(shallow > 0 && deep > 0 && tre_peak_stack > 0, "stack meter reports a nonzero high-water mark");
+    check(deep > shallow && tre_peak_stack == deep, "stack meter tracks recursion depth");
+#else
+    check(shallow == 0 && deep == 0 && tre_peak_stack == 0, "stack meter off without STACKMETER=1");
+#endif
+
+#ifdef TRE_PROFILE
+    // Heat counts: b is tried at 3 places, the lazy a twice (once per repetition) and given back twice
+    tre_profile_reset();
+    check(match("^xa*?b", "xaab", &length, 0, 1) && length == 4, "profiled lazy match");
+    check(tre_prof_exec[1] == 1 && tre_prof_exec[2] == 2 && tre_prof_exec[5] == 3
+          && tre_prof_backtrack[1] == 0 && tre_prof_backtrack[2] == 2 && tre_prof_backtrack[5] == 0,
+          "profile counts per pattern position");
+    check(tre_prof_inst_exec[0] == 1 && tre_prof_inst_exec[1] == 2 && tre_prof_inst_exec[2] == 3
+          && tre_prof_inst_backtrack[1] == 2, "profile counts per instruction");
+    match("^xa*?b", "xaab", &length, 0, 1);
+    check(tre_prof_exec[5] == 6 && tre_prof_inst_exec[2] == 6, "profile counts add up over calls");
+    match("^xa*b", "xaab", &length, 0, 1);
+    check(tre_prof_exec[4] == 1 && tre_prof_exec[5] == 0 && tre_prof_inst_exec[2] == 1, "profile counts reset for a new pattern");
+#endif
+
+    // Delimited fields: same span for every delimiter kernel, also far into long lines
+    static char line[400];
+    prog = tre_compile("^\\d+$", 0, mem, sizeof(mem));
+    int fields_ok = 1;
+    for (int level = TRE_SIMD_SCALAR; level <= TRE_SIMD_AVX512; level++) {
+        tre_simd_select(level);
+        for (int f = 0; f < 60; f++) {
+            line[0] = '\0';
+            for (int i = 0; i < 60; i++) strcat(line, i == f ? "42," : "ab,");   // field f is numeric
+            char *r = tre_match_field(prog, line, (int)strlen(line), ',', f, &length);
+            fields_ok = fields_ok && r == line + 3 * f && length == 2
+                        && !tre_match_field(prog, line, (int)strlen(line), ',', (f + 1) % 60, &length);
+        }
+    }
+    tre_simd_select(TRE_SIMD_AUTO);
+    check(fields_ok, "tre_match_field finds the field with every kernel");
+    check(!tre_match_field(prog, "1,2,3", 5, ',', 3, &length) && tre_last_error == TRE_ERROR_NO_MATCH
+          && tre_match_field(prog, "1,2,3", 5, ',', 2, &length) && length == 1, "missing field does not match");
+
+    const char *logbuf = "GET\t/a\t200\r\nPOST\t/b\t500\nGET\t/c\t503\nGET\t/d\n";
+    prog = tre_compile("^5\\d\\d$", 0, mem, sizeof(mem));
+    check(tre_scan_lines(prog, logbuf, (int)strlen(logbuf), '\t', 2, NULL, NULL) == 2, "tre_scan_lines counts matching lines");
+
+    // File sets: small chunks so lines straddle reads; io_uring and pread() agree with tre_scan_lines
+    static char logfile[64 * 1024];
+    int loglen = 0;
+    for (int i = 0; i < 3000; i++)
+        loglen += snprintf(logfile + loglen, sizeof(logfile) - loglen, "GET\t/item/%d\t%d\n", i, (i % 7) ? 200 : 503);
+    const char *paths[] = { "tre_files_a.tmp", "tre_files_missing.tmp", "tre_files_b.tmp", "tre_files_a.tmp" };
+    FILE *fa = fopen(paths[0], "wb"), *fb = fopen(paths[2], "wb");
+    if (fa) { fwrite(logfile, 1, loglen, fa); fclose(fa); }
+    if (fb) fclose(fb);
+    static unsigned char pool[64 * 1024];
+    int per_file = tre_scan_lines(prog, logfile, loglen, '\t', 2, NULL, NULL);
+    for (int mode = 0; mode < 4; mode++) {
+        static const char *const what[] = {
+            "tre_scan_files with io_uring when available", "tre_scan_files with pread()",
+            "tre_scan_files continues short io_uring reads", "tre_scan_files continues short pread() reads" };
+        tre_files_t io;
+        int ok = tre_files_init(&io, 4, 1000, 64, pool, sizeof(pool)) == 0;
+        io.sync = mode & 1;
+        io.max_read = (mode & 2) ? 300 : 0;     // every read comes back short of the chunk
+        int hits = tre_scan_files(prog, &io, paths, 4, '\t', 2, file_line_hit, &io);
+        check(ok && hits == 2 * per_file && io.files == 3 && io.errors == 1 && io.bytes == 2LL * loglen, what[mode]);
+    }
+    tre_files_t io;
+    tre_files_init(&io, 2, 700, 64, pool, sizeof(pool));
+    check(tre_scan_files(prog, &io, paths, 1, '\t', 2, file_line_stop, NULL) == 1 && io.reads <= 3,
+          "tre_scan_files stops when fn asks");
+    check(tre_files_init(&io, 4, 1000, 64, pool, tre_files_bytes(4, 1000, 64) - 1) == -1,
+          "tre_files_init rejects a short pool");
+    remove(paths[0]);
+    remove(paths[2]);
+
+    // Sampled estimate: interval covers the true count, full sample gives it exactly
+    static char archive[1 << 20];
+    int alen = 0;
+    for (int i = 0; alen < (int)sizeof(archive) - 64; i++)
+        alen += snprintf(archive + alen, sizeof(archive) - alen, "GET\t/item/%d\t%d\n", i,
+                         ((i / 800) % 3 == 0 ? i % 10 : i % 20) ? 200 : 503);
+    int truth = tre_scan_lines(prog, archive, alen, '\t', 2, NULL, NULL);
+    tre_estimate_t est;
+    tre_estimate_init(&est, 0.1, 7);
+    est.block = 4096;
+    check(tre_estimate_lines(prog, archive, alen, '\t', 2, &est) == 0 && !est.exact && est.sampled < est.blocks
+          && est.low <= truth && truth <= est.high && est.high - est.low <= 0.25 * est.estimate,
+          "tre_estimate_lines brackets the count from a sample");
+    tre_estimate_init(&est, 0.0001, 7);
+    est.block = 4096;
+    check(tre_estimate_lines(prog, archive, alen, '\t', 2, &est) == 0 && est.exact
+          && est.estimate == truth && est.low == truth && est.high == truth,
+          "tre_estimate_lines is exact once every block is read");
+    check(tre_estimate_lines(prog, archive, 0, '\t', 2, &est) == 0 && est.exact && est.blocks == 0
+          && est.estimate == 0 && est.low == 0 && est.high == 0, "tre_estimate_lines on empty input is exactly 0");
+
+    // Find-all aggregation: heavy hitters found, distinct count close, halves merge to the whole
+    static char iplog[256 * 1024];
+    int iplen = 0;
+    for (int i = 0; i < 8000; i++) {
+        int ip = (i % 10 == 0) ? i % 3 : (i * 7919) % 4000;             // 3 hot addresses, 3601 distinct in all
+        iplen += snprintf(iplog + iplen, sizeof(iplog) - iplen, "src=10.1.%d.%d ok\n", ip / 256, ip % 256);
+    }
+    static unsigned char topk_mem[64 * 1024], topk_mem2[64 * 1024];
+    static tre_hll_t hll, hll2, hll_all;
+    tre_topk_t topk, topk2;
+    tre_topk_item_t top[64];
+    tre_topk_init(&topk, 64, topk_mem, sizeof(topk_mem));
+    tre_topk_init(&topk2, 64, topk_mem2, sizeof(topk_mem2));
+    tre_hll_init(&hll);
+    tre_hll_init(&hll2);
+    tre_hll_init(&hll_all);
+    prog = tre_compile("\\b\\d+\\.\\d+\\.\\d+\\.\\d+", TRE_DFA, mem, sizeof(mem));
+    int cut = iplen / 2;
+    while (iplog[cut - 1] != '\n') cut++;
+    int nmatch = tre_aggregate(prog, iplog, cut, &topk, &hll) + tre_aggregate(prog, iplog + cut, iplen - cut, &topk2, &hll2);
+    tre_aggregate(prog, iplog, iplen, NULL, &hll_all);
+    tre_topk_merge(&topk, &topk2);
+    tre_hll_merge(&hll, &hll2);
+    int ntop = tre_topk_sorted(&topk, top);
+    int hot = 0;
+    for (int i = 0; i < 3; i++)
+        hot += top[i].len == 8 && memcmp(top[i].str, "10.1.0.", 7) == 0 && top[i].count - top[i].error >= 260;
+    double distinct = tre_hll_count(&hll);
+    check(nmatch == 8000 && ntop == 64 && hot == 3, "tre_topk keeps the heavy hitters across merged sketches");
+    // Sketches that track different keys: a (5 in all) was evicted from the 1-counter side
+    static unsigned char ka_mem[1024], kb_mem[1024];
+    tre_topk_t ka, kb;
+    tre_topk_init(&ka, 2, ka_mem, sizeof(ka_mem));
+    tre_topk_init(&kb, 1, kb_mem, sizeof(kb_mem));
+    const char *seen_a = "aab", *seen_b = "aaacccc";
+    for (int i = 0; seen_a[i]; i++) tre_topk_add(&ka, seen_a + i, 1);
+    for (int i = 0; seen_b[i]; i++) tre_topk_add(&kb, seen_b + i, 1);
+    tre_topk_merge(&ka, &kb);
+    int bounded = tre_topk_sorted(&ka, top) == 2;
+    for (int i = 0; i < 2; i++) {
+        int truth = top[i].str[0] == 'a' ? 5 : top[i].str[0] == 'b' ? 1 : 4;
+        bounded = bounded && top[i].count >= truth && top[i].count - top[i].error <= truth;
+    }
+    check(bounded && top[0].str[0] == 'a', "tre_topk_merge keeps the bounds when sketches track different keys");
+    check(distinct > 3601 * 0.95 && distinct < 3601 * 1.05 && memcmp(&hll, &hll_all, sizeof(hll)) == 0,
+          "tre_hll counts distinct matches and merges exactly");
+    check(tre_find_all(tre_compile("\\b\\w{2}", TRE_DFA, mem, sizeof(mem)), "abcd ef", 7, NULL, NULL) == 2,
+          "tre_find_all keeps \\b context when resuming mid-word");
+
+    // Boolean rules: one product scan gives the same answer as separate searches
+    static unsigned char bool_mem[32 * 1024], pm_a[4096], pm_b[4096], pm_c[4096], pm_d[4096];
+    tre_bool_t rule;
+    tre_prog_t *p_get = tre_compile("GET /api/v\\d", TRE_DFA, pm_a, sizeof(pm_a));
+    tre_prog_t *p_5xx = tre_compile("status=5\\d\\d$", 0, pm_b, sizeof(pm_b));
+    tre_prog_t *p_host = tre_compile("^host4\\d\\b", TRE_DFA, pm_c, sizeof(pm_c));
+    tre_prog_t *p_long = tre_compile("[a-z]{70}", 0, pm_d, sizeof(pm_d));          // too many units: own search
+    tre_bool_init(&rule, bool_mem, sizeof(bool_mem));
+    int bool_ok = tre_bool_add(&rule, p_get, 0) == 0 && tre_bool_add(&rule, p_5xx, 0) == 0
+               && tre_bool_add(&rule, p_host, 1) == 0 && tre_bool_add(&rule, p_long, 1) == 0;
+    const char *blines[] = { "host12 GET /api/v2/x status=503", "host42 GET /api/v2/x status=503",
+                             "host12 GET /api/v2/x status=200", "host12 POST /api/v2/x status=500",
+                             "host421 GET /api/v1 status=502", "host1 GET /api/v1 status=502 abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz" };
+    const int bwant[] = { 1, 0, 0, 0, 1, 0 };
+    for (int i = 0; i < 6; i++) bool_ok = bool_ok && tre_bool_exec(&rule, blines[i], (int)strlen(blines[i])) == bwant[i];
+    check(bool_ok && rule.nstates > 0, "tre_bool_exec evaluates P1 and P2 and not P3 in one pass");
+    static unsigned char bool_small[5600];
+    tre_bool_init(&rule, bool_small, sizeof(bool_small));
+    bool_ok = tre_bool_add(&rule, p_get, 0) == 0 && tre_bool_add(&rule, p_5xx, 0) == 0 && tre_bool_add(&rule, p_host, 1) == 0
+              && tre_bool_add(&rule, p_5xx, 0) == -1;                                   // no room for a second automaton
+    for (int k = 0; k < 3; k++)
+        for (int i = 0; i < 5; i++) bool_ok = bool_ok && tre_bool_exec(&rule, blines[i], (int)strlen(blines[i])) == bwant[i];
+    check(bool_ok && rule.flushes > 0, "tre_bool_exec stays correct when the state budget runs out");
+
+    // Pattern sets: parallel compile, shared programs and classes, same results as tre_compile()
+    static const char *rules[300];
+    static char rulebuf[300][32];
+    static tre_prog_t *set_progs[300];
+    static unsigned char arena[512 * 1024];
+    for (int i = 0; i < 300; i++) {
+        snprintf(rulebuf[i], sizeof(rulebuf[i]), "[a-f]+%d[0-9]{2}[xyz]?", i % 150);   // every rule twice
+        rules[i] = rulebuf[i];
+    }
+    tre_set_t rset;
+    int need = tre_set_size(rules, 300, TRE_DFA, 4);
+    int set_ok = need > 0 && need <= (int)sizeof(arena)
+              && tre_set_compile(&rset, rules, 300, TRE_DFA, set_progs, arena, sizeof(arena), 4) == 0;
+    check(set_ok && rset.programs == 150 && set_progs[7] == set_progs[157] && rset.classes == 450
+          && rset.classes_stored == 3 && rset.used < need / 2, "set compile shares programs and classes");
+    for (int i = 0; set_ok && i < 300; i++) {
+        int len1 = -1, len2 = -1;
+        snprintf(line, sizeof(line), "zz cafe%d42x", i % 150);
+        prog = tre_compile(rules[i], TRE_DFA, mem, sizeof(mem));
+        set_ok = prog && tre_exec(set_progs[i], line, &len1, 1) == tre_exec(prog, line, &len2, 1) && len1 == len2 && len1 > 0;
+    }
+    check(set_ok, "set programs match like tre_compile() ones");
+
+    // Footprint: hot block on a cache line, pattern copy outside it
+    tre_footprint_t fp;
+    prog = tre_compile("[a-f]+x[0-9]{2}", TRE_DFA, mem + 1, sizeof(mem) - 1);
+    tre_prog_footprint(prog, &fp);
+    check(prog && ((size_t)prog & 63) == 0 && fp.hot % 64 == 0 && fp.classes == 64 && fp.dfa > 0
+          && fp.header + fp.inst + fp.dfa + fp.classes <= fp.hot && fp.hot + fp.cold <= fp.total
+          && fp.total == tre_compile_size("[a-f]+x[0-9]{2}", TRE_DFA), "tre_prog_footprint splits hot and cold bytes");
+    tre_prog_footprint(set_progs[0], &fp);
+    check(set_ok && fp.classes == 0 && (unsigned char *)set_progs[1] == (unsigned char *)set_progs[0] + fp.hot,
+          "set programs' hot blocks sit back to back");
+    rules[123] = "a{2";
+    check(tre_set_compile(&rset, rules, 300, 0, set_progs, arena, sizeof(arena), 4) == -1 && rset.failed == 123
+          && tre_last_error == TRE_ERROR_MALFORMED_PATTERN, "set compile reports the bad pattern");
+    rules[123] = rulebuf[123];
+    check(tre_set_compile(&rset, rules, 300, 0, set_progs, arena, 4096, 4) == -1 && tre_last_error == TRE_ERROR_PATTERN_TOO_LONG,
+          "set compile checks the arena size");
+
+    // Subsumption: covered and duplicate rules point at a kept one
+    static unsigned char sub_work[64 * 1024];
+    const char *acc[] = { "abc", "ab.", "[0-9]{3}", "[0-9]+", "abc", "\\bcat\\b", "^x\\d", "cat" };
+    int sub[8];
+    check(tre_set_compile(&rset, acc, 8, 0, set_progs, arena, sizeof(arena), 1) == 0
+          && tre_set_reduce(&rset, sub, sub_work, sizeof(sub_work)) == 3
+          && sub[0] == 1 && sub[1] == -1 && sub[2] == 3 && sub[3] == -1 && sub[4] == 1
+          && sub[5] == 7 && sub[6] == 3 && sub[7] == -1, "tre_set_reduce drops subsumed patterns");
+    check(tre_subsumes(set_progs[3], set_progs[2], sub_work, sizeof(sub_work)) == 0
+          && tre_subsumes(set_progs[0], set_progs[1], sub_work, 64) == -1, "tre_subsumes is one-way and needs work memory");
+
+    // TRE_SET_REDUCE: covered patterns only run where their cover matched, same bits
+    static const char *const acc_texts[] = { "", "abc", "abd", "x12", "a cat", "concat 123", "x1" };
+    unsigned char plain_bits[1], reduced_bits[1];
+    tre_set_t plain;
+    static tre_prog_t *plain_progs[8];
+    static unsigned char plain_arena[1 << 14];
+    int rsize = tre_set_size(acc, 8, TRE_SET_REDUCE, 1);
+    int same_bits = rsize > 0 && rsize <= (int)sizeof(arena)
+                 && tre_set_compile(&plain, acc, 8, 0, plain_progs, plain_arena, sizeof(plain_arena), 1) == 0
+                 && tre_set_compile(&rset, acc, 8, TRE_SET_REDUCE, set_progs, arena, rsize, 1) == 0;
+    for (size_t t = 0; same_bits && t < sizeof(acc_texts) / sizeof(acc_texts[0]); t++) {
+        int len = (int)strlen(acc_texts[t]);
+        same_bits = tre_set_match(&plain, acc_texts[t], len, plain_bits) == tre_set_match(&rset, acc_texts[t], len, reduced_bits)
+                 && plain_bits[0] == reduced_bits[0];
+    }
+    check(same_bits && rset.covered_by && rset.covered_by[0] == 1 && rset.covered_by[1] == -1 && rset.covered_by[6] == 3
+          && rset.flags == 0 && plain.covered_by == NULL, "TRE_SET_REDUCE skips covered patterns, same matches");
+
+    // Literal sets: every occurrence in text order, shorter first; large plain sets get the index
+    static unsigned char lits_mem[4096];
+    const char *kws[] = { "error", "err", "timeout", "connection reset by peer", "err", "o", "refused" };
+    int lits_k[16], lits_at[16];
+    lits_hits_t lh = { 0, lits_k, lits_at, "err: connection reset by peer (timeout)" };
+    tre_lits_t lits;
+    check(tre_lits_bytes(kws, NULL, 7) <= (int)sizeof(lits_mem) && tre_lits_init(&lits, kws, NULL, 7, lits_mem, sizeof(lits_mem)) == 0
+          && tre_lits_scan(&lits, lh.text, (int)strlen(lh.text), on_lit, &lh) == 7 && lh.n == 7
+          && lits_k[0] == 1 && lits_k[1] == 4 && lits_at[1] == 0 && lits_k[2] == 3 && lits_at[2] == 5
+          && lits_k[3] == 5 && lits_at[3] == 6 && lits_k[5] == 2 && lits_at[5] == 31 && lits_at[6] == 35,
+          "tre_lits_scan reports every keyword occurrence");
+
+    static char kwbuf[1200][16];
+    static const char *kw_rules[1200];
+    static tre_prog_t *kw_progs[1200];
+    static unsigned char kw_arena[2 * 1024 * 1024];
+    static unsigned char kw_sel[150], kw_ref[150];
+    for (int i = 0; i < 1200; i++) {
+        snprintf(kwbuf[i], sizeof(kwbuf[i]), i % 3 ? "host%d:" : "id=%d&", i * 7);
+        kw_rules[i] = kwbuf[i];
+    }
+    const char *kw_text = "GET /a?id=105&x=1 from host14:, host8393:; id=8400& host7:";
+    need = tre_set_size(kw_rules, 1200, 0, 2);
+    int lits_ok = need > 0 && need <= (int)sizeof(kw_arena)
+               && tre_set_compile(&rset, kw_rules, 1200, 0, kw_progs, kw_arena, sizeof(kw_arena), 2) == 0 && rset.lits;
+    int kw_n = lits_ok ? tre_set_match(&rset, kw_text, (int)strlen(kw_text), kw_sel) : -1;
+    // Reference: each keyword's program, compiled on demand
+    memset(kw_ref, 0, sizeof(kw_ref));
+    for (int i = 0; lits_ok && i < 1200; i++) {
+        prog = tre_set_prog(&rset, i, mem, sizeof(mem));
+        lits_ok = prog && rset.progs[i] == NULL && tre_set_prog_size(&rset, i) <= (int)sizeof(mem);
+        if (lits_ok && tre_execn(prog, kw_text, (int)strlen(kw_text), NULL, 1)) kw_ref[i >> 3] |= (unsigned char)(1 << (i & 7));
+    }
+    lits_ok = lits_ok && memcmp(kw_sel, kw_ref, sizeof(kw_sel)) == 0 && kw_n == 4 && rset.lits->n == 1200;
+    check(lits_ok, "tre_set_match uses a keyword index for large literal sets");
+    // Without the index (TRE_IGNCASE) every keyword gets a program
+    int prog_need = tre_set_size(kw_rules, 1200, TRE_IGNCASE, 2);
+    check(lits_ok && rset.programs == 0 && need * 8 < prog_need && rset.used < 1200 * 64,
+          "keyword sets store no programs, so they take a fraction of the memory");
+    static int kw_sub[1200];
+    kw_rules[5] = "host7:";              // contains host7: from rule 1, and duplicates it
+    check(tre_set_compile(&rset, kw_rules, 1200, 0, kw_progs, kw_arena, sizeof(kw_arena), 2) == 0
+          && tre_set_reduce(&rset, kw_sub, NULL, 0) == 1199 && kw_sub[5] == 1 && kw_sub[1] == -1,
+          "tre_set_reduce compares keywords of an indexed set directly");
+}
+
 int main(void) {
     size_t total = sizeof(tests) / sizeof(tests[0]);
     size_t passed = 0;
@@ -164,6 +813,11 @@ int main(void) {
             printf("\n");
         }
     }
+    printf("\n");
+    api_tests();
+    total += api_total;
+    passed += api_passed;
+
     printf("\n%zu / %zu tests passed (%.1f%%)\n", passed, total, (double)passed / total * 100);
     return (passed == total) ? 0 : 1;
 }
@@ -0,0 +1,187 @@
+/* Tests for the C++ interface (include/tre.hpp) */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+#include "tre.hpp"
+
+#ifdef TRE_HPP_COROUTINES
+#include <coroutine>
+#include <deque>
+
+// Just enough of an event loop: a source whose reads complete later, from run()
+struct loop_t {
+    std::deque<std::coroutine_handle<>> ready;
+    void run() { while (!ready.empty()) { auto h = ready.front(); ready.pop_front(); h.resume(); } }
+};
+
+struct chunk_source {
+    loop_t          *loop;
+    std::string_view data;
+    size_t           chunk;
+
+    struct read {
+        chunk_source *src;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) const { src->loop->ready.push_back(h); }
+        std::string_view await_resume() const noexcept {
+            std::string_view c = src->data.substr(0, src->chunk);
+            src->data.remove_prefix(c.size());
+            return c;
+        }
+    };
+    read next() { return read{this}; }
+};
+
+// Fire-and-forget consumer coroutine, driven by the loop
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+struct collected {
+    std::vector<std::pair<std::uint64_t, std::string>> events;
+    int error = 0;
+};
+
+static task collect(const tre::regex &re, chunk_source &src, size_t lookback, collected &out) {
+    auto gen = tre::stream_matches(re, src, lookback);
+    try {
+        while (const tre::match_event *ev = co_await gen.next())
+            out.events.emplace_back(ev->offset, std::string(ev->text));
+    } catch (const tre::error &e) {
+        out.error = e.code();
+    }
+}
+
+static collected stream(const tre::regex &re, std::string_view text, size_t chunk, size_t lookback) {
+    loop_t loop;
+    chunk_source src{&loop, text, chunk};
+    collected out;
+    collect(re, src, lookback, out);
+    loop.run();
+    return out;
+}
+#endif
+
+static size_t total = 0, passed = 0;
+
+static void check(bool ok, const char *what) {
+    total++;
+    if (ok) passed++;
+    std::printf("[%s] cpp  %s\n", ok ? "PASS" : "FAIL", what);
+}
+
+static int on_span(const char *m, int len, void *user) {
+    static_cast<std::vector<std::string_view> *>(user)->emplace_back(m, static_cast<size_t>(len));
+    return 0;
+}
+
+int main() {
+    using namespace std::string_view_literals;
+
+    tre::regex re("[0-9]+");
+    check(re.test("abc 42"), "regex::test finds a match");
+    check(!re.test("abc"), "regex::test without a match");
+
+    // No terminator: the view ends before the second number
+    const char buf[] = "id=17;id=99";
+    std::string_view first(buf, 5);
+    auto m = re.find(first);
+    check(m && *m == "17" && m->data() == buf + 3, "find returns a view into the text");
+    check(!re.find(std::string_view(buf, 3)), "find stops at the end of the view");
+    check(!re.find(std::string_view()), "find on an empty view");
+
+    std::vector<std::string_view> all;
+    for (std::string_view s : re.matches("a1 b22 c333"sv)) all.push_back(s);
+    check(all.size() == 3 && all[0] == "1" && all[1] == "22" && all[2] == "333", "matches() yields every match in order");
+
+    // Same spans, in the same order, as the callback API
+    tre::regex star("b*");
+    std::vector<std::string_view> spans;
+    const char *bs = "abba b";
+    tre_find_all(star.get(), bs, 6, on_span, &spans);
+    auto bm = star.matches(bs);
+    all.assign(bm.begin(), bm.end());
+    check(all == spans && all.size() == 2, "matches() agrees with tre_find_all()");
+
+    tre::regex anch("^ab");
+    int n = 0;
+    for (std::string_view s : anch.matches("abab")) { (void)s; n++; }
+    check(n == 1, "an anchored pattern matches only at the start");
+
+    tre::regex moved(std::move(re));
+    check(moved.test("7") && re.get() == nullptr, "a moved-from regex gives up its program");
+    re = std::move(moved);
+    check(re.test("7") && moved.get() == nullptr, "move assignment transfers the program");
+
+    int code = 0;
+    try { tre::regex bad("a{2"); } catch (const tre::error &e) { code = e.code(); }
+    check(code == TRE_ERROR_MALFORMED_PATTERN, "a bad pattern throws tre::error");
+
+    // A search cut off by a limit throws instead of looking like no match
+    tre::regex slow_find("a+a+a+a+b");
+    const std::string many_a(40, 'a');
+    tre_max_backtrack_steps = 64;
+    code = 0;
+    try { (void)slow_find.find(many_a); } catch (const tre::error &e) { code = e.code(); }
+    check(code == TRE_ERROR_BACKTRACK_LIMIT, "find() throws when cut off by the backtrack limit");
+    code = 0;
+    try { (void)slow_find.test(many_a); } catch (const tre::error &e) { code = e.code(); }
+    check(code == TRE_ERROR_BACKTRACK_LIMIT, "test() throws when cut off by the backtrack limit");
+    code = 0;
+    n = 0;
+    try { for (std::string_view s : slow_find.matches(many_a)) { (void)s; n++; } } catch (const tre::error &e) { code = e.code(); }
+    check(code == TRE_ERROR_BACKTRACK_LIMIT && n == 0, "matches() throws when cut off by the backtrack limit");
+    tre_max_backtrack_steps = TRE_DEFAULT_MAX_BACKTRACK_STEPS;
+    check(!slow_find.find("aab ab"sv.substr(3, 1)), "no match is still std::nullopt");
+
+#if __cplusplus >= 202002L
+    static_assert(std::ranges::view<tre::match_range>);
+    static_assert(std::ranges::borrowed_range<tre::match_range>);
+    auto longer = re.matches("1 22 333 4444") | std::views::filter([](std::string_view s) { return s.size() > 2; });
+    all.clear();
+    for (std::string_view s : longer) all.push_back(s);
+    check(all.size() == 2 && all[0] == "333", "matches() composes with range adaptors");
+#endif
+
+#ifdef TRE_HPP_COROUTINES
+    // Streamed in chunks of every size, the matches are the whole-text ones
+    static const char *const pats[] = { "[0-9]+", "\\bid=[a-z]+\\b", "^ab", "b*", "x[0-9]?$" };
+    const char *ltext = "ab id=ok 12 xid=no 345 abba id=yes 6 x7";
+    bool same = true;
+    for (const char *p : pats) {
+        tre::regex pr(p);
+        std::vector<std::string_view> whole;
+        tre_find_all(pr.get(), ltext, static_cast<int>(std::strlen(ltext)), on_span, &whole);
+        for (size_t chunk = 1; chunk <= 8; chunk++) {
+            collected got = stream(pr, ltext, chunk, 8);
+            same = same && got.events.size() == whole.size();
+            for (size_t i = 0; same && i < whole.size(); i++)
+                same = got.events[i].first == static_cast<std::uint64_t>(whole[i].data() - ltext) && got.events[i].second == whole[i];
+        }
+    }
+    check(same, "stream_matches() reports the whole-text matches at absolute offsets");
+
+    collected none = stream(re, "", 4, 4);
+    check(none.events.empty() && none.error == 0, "stream_matches() over empty input");
+
+    tre::regex slow("a+a+a+a+b");
+    collected cut = stream(slow, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 16, 64);
+    check(cut.error == TRE_ERROR_BACKTRACK_LIMIT, "a cut-off search is thrown from next()");
+#endif
+
+    std::printf("\n%zu/%zu C++ tests passed\n", passed, total);
+    return passed == total ? 0 : 1;
+}
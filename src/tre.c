@@ -1,33 +1,217 @@
+#define _POSIX_C_SOURCE 200809L      // clock_gettime(), pthreads, pread()
+#ifdef __linux__
+#define _DEFAULT_SOURCE              // syscall(), for io_uring
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include "tre.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef TRE_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef __linux__
+#define TRE_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRE_X86 1
+#include <immintrin.h>
+#endif
+
 // Global configuration variables (initialized to safe defaults)
 int tre_max_pattern_length  = TRE_DEFAULT_MAX_PATTERN_LENGTH;
 int tre_max_depth           = TRE_DEFAULT_MAX_RECURSION_DEPTH;
 int tre_max_backtrack_steps = TRE_DEFAULT_MAX_BACKTRACK_STEPS;
+int tre_max_program_size    = TRE_DEFAULT_MAX_PROGRAM_SIZE;
 
 int tre_last_error = 0;
 
 int tre_peak_backtrack = 0;
 int tre_peak_recursion = 0;
+int tre_peak_stack = 0;
+int tre_last_stack = 0;
 
 // Internal backtracking step counter (reset for each match call)
 static int tre_backtrack_steps = 0;
+static int tre_call_depth = 0;                 // deepest recursion of the current match call
 static int tre_igncase = 0;                    // Case-sensitive by default
+static int tre_text_folded = 0;                // text is already lowercased (tre_exec_folded)
+
+// Text being searched by the current call: [tre_text_start, tre_text_end)
+static const char *tre_text_start = NULL;      // start of the text, for \b and \B
+static const char *tre_text_origin = NULL;     // set by tre_find_all(): \b may look back before text
+static const char *tre_text_end   = NULL;      // end of the text, for $ and repetitions
 
 void tre_reset_peaks(void) {
     tre_peak_backtrack = 0;
     tre_peak_recursion = 0;
+    tre_peak_stack = 0;
+}
+
+// ─────────────────────────────────────────────────────
+// Stack meter (TRE_STACKMETER builds): bytes between the
+// search entry and the deepest matchhere() frame
+// ─────────────────────────────────────────────────────
+#ifdef TRE_STACKMETER
+static const char *tre_stack_base;
+
+static void tre_stack_sample(const volatile char *probe) {
+    int used = (int)(tre_stack_base - (const char *)probe);
+    if (used > tre_last_stack) tre_last_stack = used;
+    if (used > tre_peak_stack) tre_peak_stack = used;
+}
+#define TRE_STACK_START()   (tre_stack_base = (const char *)__builtin_frame_address(0), tre_last_stack = 0)
+#define TRE_STACK_SAMPLE()  do { volatile char probe_ = 0; tre_stack_sample(&probe_); } while (0)
+#else
+#define TRE_STACK_START()   ((void)0)
+#define TRE_STACK_SAMPLE()  ((void)0)
+#endif
+
+// ─────────────────────────────────────────────────────
+// Profiler: heat counters per pattern position
+// ─────────────────────────────────────────────────────
+unsigned long tre_prof_exec[TRE_PROFILE_MAX_PATTERN];
+unsigned long tre_prof_backtrack[TRE_PROFILE_MAX_PATTERN];
+unsigned long tre_prof_inst_exec[TRE_PROFILE_MAX_PATTERN];
+unsigned long tre_prof_inst_backtrack[TRE_PROFILE_MAX_PATTERN];
+tre_trace_fn  tre_trace_hook = NULL;
+void         *tre_trace_user = NULL;
+
+static char  tre_prof_pattern[TRE_PROFILE_MAX_PATTERN + 1];  // pattern the counters belong to
+
+void tre_profile_reset(void) {
+    memset(tre_prof_exec, 0, sizeof(tre_prof_exec));
+    memset(tre_prof_backtrack, 0, sizeof(tre_prof_backtrack));
+    memset(tre_prof_inst_exec, 0, sizeof(tre_prof_inst_exec));
+    memset(tre_prof_inst_backtrack, 0, sizeof(tre_prof_inst_backtrack));
+}
+
+#ifdef TRE_PROFILE
+static const void *tre_prof_prog;     // program last checked against tre_prof_pattern
+static const void *tre_prof_inst;     // its first instruction (tre_inst_t is defined below)
+
+// Compiling may reuse a program's memory for another pattern: check the next one again
+#define TRE_PROF_FORGET()              (tre_prof_prog = NULL)
+
+static void tre_prof_start(const void *prog, const char *pattern, const void *inst) {
+    if (prog == tre_prof_prog) return;
+    tre_prof_prog = prog;
+    tre_prof_inst = inst;
+    if (strncmp(tre_prof_pattern, pattern, TRE_PROFILE_MAX_PATTERN) != 0) {
+        strncpy(tre_prof_pattern, pattern, TRE_PROFILE_MAX_PATTERN);
+        tre_profile_reset();
+    }
+}
+
+static void tre_prof_hit(int event, int pos, int idx, const char *text) {
+    if (idx >= 0 && idx < TRE_PROFILE_MAX_PATTERN) {
+        if (event == TRE_TRACE_EXEC) tre_prof_inst_exec[idx]++;
+        else                         tre_prof_inst_backtrack[idx]++;
+    }
+    if (pos < 0 || pos >= TRE_PROFILE_MAX_PATTERN) return;
+    if (event == TRE_TRACE_EXEC) tre_prof_exec[pos]++;
+    else                         tre_prof_backtrack[pos]++;
+    if (tre_trace_hook) tre_trace_hook(event, pos, text, tre_trace_user);
+}
+#define TRE_PROF_START(prog)           tre_prof_start(prog, (prog)->pattern, (prog)->inst)
+#define TRE_PROF(event, pc, text)      tre_prof_hit(event, (pc)->pos, (int)((pc) - (const tre_inst_t *)tre_prof_inst), text)
+#else
+#define TRE_PROF_FORGET()              ((void)0)
+#define TRE_PROF_START(prog)           ((void)0)
+#define TRE_PROF(event, pc, text)      ((void)0)
+#endif
+
+/* Helper: length of the atom at re, including a following quantifier */
+static int atomlen(const char *re) {
+    const char *p = re;
+    if (p[0] == '\\' && p[1] != '\0') p += 2;
+    else if (p[0] == '[' && strchr(p, ']')) p = strchr(p, ']') + 1;
+    else p++;
+    if (*p == '{' && strchr(p, '}')) p = strchr(p, '}') + 1;
+    else if (*p == '*' || *p == '+' || *p == '?') p++;
+    else return (int)(p - re);
+    if (*p == '?') p++;   // lazy
+    return (int)(p - re);
+}
+
+void tre_profile_dump(FILE *out) {
+    const char *re = tre_prof_pattern;
+    unsigned long total = 0;
+    int len = (int)strlen(re);
+
+    for (int i = 0; i < len; i++) total += tre_prof_exec[i] + tre_prof_backtrack[i];
+#ifndef TRE_PROFILE
+    fprintf(out, "tre: profiling disabled (rebuild with -DTRE_PROFILE)\n");
+#endif
+    fprintf(out, "pattern: %s\n", re);
+    fprintf(out, "  %3s  %-16s %9s  %10s  %6s\n", "pos", "atom", "exec", "backtrack", "heat");
+
+    int pos = (re[0] == '^') ? 1 : 0;
+    while (pos < len) {
+        int n = atomlen(re + pos);
+        unsigned long hits = tre_prof_exec[pos] + tre_prof_backtrack[pos];
+        fprintf(out, "  %3d  %-16.*s %9lu  %10lu  %5.1f%%\n", pos, n, re + pos,
+                tre_prof_exec[pos], tre_prof_backtrack[pos],
+                total ? 100.0 * (double)hits / (double)total : 0.0);
+        pos += n;
+    }
+}
+
+// ─────────────────────────────────────────────────────
+// Shorthand classes \d \w \s as constant 256-bit tables
+// ─────────────────────────────────────────────────────
+static const unsigned char tre_class_digit[32] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+static const unsigned char tre_class_word[32] = {       // [0-9A-Za-z_]
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x03, 0xfe, 0xff, 0xff, 0x87, 0xfe, 0xff, 0xff, 0x07,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+static const unsigned char tre_class_space[32] = {      // [ \t\n\v\f\r]
+    0x00, 0x3e, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+#define TRE_INTABLE(tab, c)  (((tab)[(unsigned char)(c) >> 3] >> ((unsigned char)(c) & 7)) & 1)
+
+/* Table for \d \w \s (upper case = negated), or NULL if esc is not a shorthand */
+static const unsigned char *shorthand(char esc, int *negate) {
+    *negate = (esc == 'D' || esc == 'W' || esc == 'S');
+    switch (tolower((unsigned char)esc)) {
+        case 'd': return tre_class_digit;
+        case 'w': return tre_class_word;
+        case 's': return tre_class_space;
+    }
+    return NULL;
+}
+
+/* \b (word boundary) and \B: compare the word-ness of the bytes around text */
+static int matchboundary(const char *text) {
+    int before = (text > tre_text_start) && TRE_INTABLE(tre_class_word, text[-1]);
+    int after  = (text < tre_text_end)   && TRE_INTABLE(tre_class_word, text[0]);
+    return before != after;
 }
 
-static int matchcompare(char a, char b) {
-    return tre_igncase ? (tolower((unsigned char)a) == tolower((unsigned char)b)) : (a == b);
+static int matchcompare(char a, char b, int igncase) {
+    return igncase ? (tolower((unsigned char)a) == tolower((unsigned char)b)) : (a == b);
 }
 
 /* Helper: check if ch is in [class] or [^class], supports a-z ranges */
-static int matchinclass(char ch, const char *cls) {
+static int matchinclass(char ch, const char *cls, int igncase) {
     int negate = 0;
     if (*cls == '^') { negate = 1; cls++; }
 
@@ -36,7 +220,7 @@ static int matchinclass(char ch, const char *cls) {
         if (cls[1] == '-' && cls[2] && cls[2] != ']') {
             char low = *cls;
             char high = cls[2];
-            if (tre_igncase) {
+            if (igncase) {
                 low  = tolower((unsigned char)low);
                 high = tolower((unsigned char)high);
                 ch   = tolower((unsigned char)ch);
@@ -44,116 +228,780 @@ static int matchinclass(char ch, const char *cls) {
             if (ch >= low && ch <= high) matched = 1;
             cls += 2;
         } else {
-            if (matchcompare(ch, *cls)) matched = 1;
+            if (matchcompare(ch, *cls, igncase)) matched = 1;
             cls++;
         }
     }
     return negate ? !matched : matched;
 }
 
-// Returns: number of chars matched in text (0 or 1)
-// Advances *regexp_ptr past the atom AND any following {n} quantifier
-// Sets *repeat_count = n if {n} was found, otherwise *repeat_count = 1
-static int matchoneatom(char **regexp_ptr, char *text, int *repeat_count)
-{
-    char *re = *regexp_ptr;
-    *repeat_count = 1;
-    if (*text == '\0') return 0;
-
-    char *start_re = re;
-    // Match one unit (same as before)
-    if (re[0] == '\\' && re[1] != '\0') {
-        if (matchcompare(*text, re[1])) re += 2;
-        else return 0;
-    } else if (re[0] == '[') {
-        char *close = strchr(re, ']');
-        if (!close || !matchinclass(*text, re+1)) return 0;
-        re = close + 1;
-    } else if (re[0] == '.') {
-        re++;
-    } else if (matchcompare(*text, re[0])) {
-        re++;
-    } else return 0;
-
-    // Now check for {n}
-    if (*re == '{') {
-        re++;  // skip {
-        int n = 0;
-        while (*re >= '0' && *re <= '9') {
-            n = n * 10 + (*re - '0');
+// ─────────────────────────────────────────────────────
+// Start-byte scanning kernels
+//
+// Every match begins with a byte its first atom accepts
+// (even x* and x? look at one), so the search loop can
+// jump straight to such bytes. The scanner comes in
+// scalar, SSE2, AVX2 and AVX-512 versions, all built
+// into the library; the best one the CPU supports is
+// picked on first use (TRE_SIMD / tre_simd_select()
+// override it).
+// ─────────────────────────────────────────────────────
+enum {
+    TRE_SCAN_NONE,       // any byte can start a match
+    TRE_SCAN_BYTES,      // one of bytes[0..nbytes-1]
+    TRE_SCAN_SET         // any byte in set
+};
+
+typedef struct {
+    int kind;
+    int nbytes;
+    unsigned char bytes[4];
+    unsigned char set[32];       // 256-bit membership table
+    unsigned char lo[16];        // set as nibble tables: bit h of lo[l] = byte 0xhl, h < 8
+    unsigned char hi[16];        //                       bit h of hi[l] = byte 0x(h+8)l
+} tre_scan_t;
+
+typedef const char *(*tre_scan_fn)(const tre_scan_t *sc, const char *p, const char *end);
+
+/* Fill sc from a 256-bit set of start bytes */
+static void scan_init(tre_scan_t *sc, const unsigned char *set)
+{
+    memset(sc, 0, sizeof(*sc));
+    memcpy(sc->set, set, 32);
+    int count = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!TRE_INTABLE(set, c)) continue;
+        if (count < 4) sc->bytes[count] = (unsigned char)c;
+        count++;
+        if (c < 128) sc->lo[c & 15] |= (unsigned char)(1 << (c >> 4));
+        else         sc->hi[c & 15] |= (unsigned char)(1 << ((c >> 4) - 8));
+    }
+    if (count == 256) return;    // nothing to skip
+    sc->nbytes = count;
+    sc->kind = (count <= 4) ? TRE_SCAN_BYTES : TRE_SCAN_SET;
+}
+
+static const char *scan_scalar(const tre_scan_t *sc, const char *p, const char *end)
+{
+    while (p < end && !TRE_INTABLE(sc->set, *p)) p++;
+    return p;
+}
+
+#ifdef TRE_X86
+__attribute__((target("sse2")))
+static const char *scan_sse2(const tre_scan_t *sc, const char *p, const char *end)
+{
+    if (sc->kind == TRE_SCAN_BYTES) {
+        __m128i b[4];
+        for (int i = 0; i < 4; i++)
+            b[i] = _mm_set1_epi8((char)sc->bytes[i < sc->nbytes ? i : 0]);
+        for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, b[0]), _mm_cmpeq_epi8(v, b[1])),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, b[2]), _mm_cmpeq_epi8(v, b[3])));
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) return p + __builtin_ctz((unsigned)mask);
+        }
+    }
+    return scan_scalar(sc, p, end);   // larger sets need pshufb: scalar on SSE2
+}
+
+/* Set membership for 32 bytes at once ("truffle": two nibble table lookups) */
+__attribute__((target("avx2")))
+static inline unsigned scan_avx2_set(__m256i v, __m256i lo, __m256i hi, __m256i bits)
+{
+    __m256i nib  = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+    __m256i rows = _mm256_or_si256(_mm256_shuffle_epi8(lo, v),
+                                   _mm256_shuffle_epi8(hi, _mm256_xor_si256(v, _mm256_set1_epi8((char)0x80))));
+    __m256i hit  = _mm256_and_si256(rows, _mm256_shuffle_epi8(bits, nib));
+    return ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const tre_scan_t *sc, const char *p, const char *end)
+{
+    if (sc->kind == TRE_SCAN_BYTES) {
+        __m256i b[4];
+        for (int i = 0; i < 4; i++)
+            b[i] = _mm256_set1_epi8((char)sc->bytes[i < sc->nbytes ? i : 0]);
+        for (; end - p >= 32; p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, b[0]), _mm256_cmpeq_epi8(v, b[1])),
+                                          _mm256_or_si256(_mm256_cmpeq_epi8(v, b[2]), _mm256_cmpeq_epi8(v, b[3])));
+            unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+            if (mask) return p + __builtin_ctz(mask);
+        }
+    } else {
+        __m256i lo   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->lo));
+        __m256i hi   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->hi));
+        __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        for (; end - p >= 32; p += 32) {
+            unsigned mask = scan_avx2_set(_mm256_loadu_si256((const __m256i *)p), lo, hi, bits);
+            if (mask) return p + __builtin_ctz(mask);
+        }
+    }
+    return scan_scalar(sc, p, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *scan_avx512(const tre_scan_t *sc, const char *p, const char *end)
+{
+    if (sc->kind == TRE_SCAN_BYTES) {
+        __m512i b[4];
+        for (int i = 0; i < 4; i++)
+            b[i] = _mm512_set1_epi8((char)sc->bytes[i < sc->nbytes ? i : 0]);
+        for (; end - p >= 64; p += 64) {
+            __m512i v = _mm512_loadu_si512((const void *)p);
+            __mmask64 mask = _mm512_cmpeq_epi8_mask(v, b[0]) | _mm512_cmpeq_epi8_mask(v, b[1])
+                           | _mm512_cmpeq_epi8_mask(v, b[2]) | _mm512_cmpeq_epi8_mask(v, b[3]);
+            if (mask) return p + __builtin_ctzll(mask);
+        }
+    } else {
+        __m512i lo   = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)sc->lo));
+        __m512i hi   = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)sc->hi));
+        __m512i bits = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                            1, 2, 4, 8, 16, 32, 64, -128));
+        for (; end - p >= 64; p += 64) {
+            __m512i v    = _mm512_loadu_si512((const void *)p);
+            __m512i nib  = _mm512_and_si512(_mm512_srli_epi16(v, 4), _mm512_set1_epi8(0x0f));
+            __m512i rows = _mm512_or_si512(_mm512_shuffle_epi8(lo, v),
+                                           _mm512_shuffle_epi8(hi, _mm512_xor_si512(v, _mm512_set1_epi8((char)0x80))));
+            __mmask64 mask = _mm512_test_epi8_mask(rows, _mm512_shuffle_epi8(bits, nib));
+            if (mask) return p + __builtin_ctzll(mask);
+        }
+    }
+    return scan_avx2(sc, p, end);     // tail: one more 32-byte step before going scalar
+}
+#endif
+
+static int         tre_simd = -1;                // level in effect, -1 = not chosen yet
+static tre_scan_fn tre_scan = scan_scalar;
+
+/* Highest level this CPU runs */
+static int simd_supported(void)
+{
+#ifdef TRE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return TRE_SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return TRE_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return TRE_SIMD_SSE2;
+#endif
+    return TRE_SIMD_SCALAR;
+}
+
+int tre_simd_select(int level)
+{
+    int best = simd_supported();
+    if (level == TRE_SIMD_AUTO) {
+        const char *env = getenv("TRE_SIMD");
+        level = best;
+        if (env) {
+            if      (strcmp(env, "scalar") == 0) level = TRE_SIMD_SCALAR;
+            else if (strcmp(env, "sse2")   == 0) level = TRE_SIMD_SSE2;
+            else if (strcmp(env, "avx2")   == 0) level = TRE_SIMD_AVX2;
+            else if (strcmp(env, "avx512") == 0) level = TRE_SIMD_AVX512;
+        }
+    }
+    if (level < TRE_SIMD_SCALAR) level = TRE_SIMD_SCALAR;
+    if (level > best) level = best;
+
+    tre_scan = scan_scalar;
+#ifdef TRE_X86
+    if (level == TRE_SIMD_SSE2)   tre_scan = scan_sse2;
+    if (level == TRE_SIMD_AVX2)   tre_scan = scan_avx2;
+    if (level == TRE_SIMD_AVX512) tre_scan = scan_avx512;
+#endif
+    tre_simd = level;
+    return level;
+}
+
+int tre_simd_level(void)
+{
+    return (tre_simd < 0) ? tre_simd_select(TRE_SIMD_AUTO) : tre_simd;
+}
+
+/* First byte at or after p that can start a match, or end */
+static inline const char *scan_start(const tre_scan_t *sc, const char *p, const char *end)
+{
+    if (tre_simd < 0) tre_simd_select(TRE_SIMD_AUTO);
+    return tre_scan(sc, p, end);
+}
+
+// ─────────────────────────────────────────────────────
+// Compiled programs
+//
+// A pattern compiles to one instruction per atom, so the
+// matcher dispatches on an opcode instead of re-parsing
+// the pattern text at every step. Everything lives in a
+// single caller-supplied block:
+//
+//   [tre_prog_t] [instructions + END] [automaton] [class bitmaps] [pattern]
+//
+// The automaton is only built for TRE_DFA programs.
+// ─────────────────────────────────────────────────────
+enum {
+    TRE_OP_END,          // pattern matched
+    TRE_OP_EOL,          // $ at the end of the pattern
+    TRE_OP_CHAR,         // literal byte (lower case when TRE_IGNCASE)
+    TRE_OP_ANY,          // .
+    TRE_OP_CLASS,        // [...], \d, \w, \s and negations
+    TRE_OP_WORDB,        // \b
+    TRE_OP_NWORDB        // \B
+};
+
+typedef struct {
+    unsigned char op;            // TRE_OP_*
+    unsigned char lazy;          // 1 = lazy repetition
+    unsigned char ch;            // TRE_OP_CHAR: the literal
+    unsigned char neg;           // TRE_OP_CLASS: 1 = complement of set
+    int pos;                     // offset of the atom in the pattern (profiling)
+    int min, max;                // repetition bounds, max -1 = unbounded
+    const unsigned char *set;    // TRE_OP_CLASS: 256-bit membership table
+} tre_inst_t;
+
+/*
+ * Bit-parallel automaton (TRE_DFA). Every atom expands into "units" that each
+ * consume one byte: x{2,4} becomes x x x? x?, x+ a single looping unit. A DFA
+ * state is the set of units ready to consume the next byte, one bit per unit,
+ * and bit m (one past the last unit) means "matched". Transitions are computed
+ * with a few word operations from the units accepting the byte, so no state
+ * table has to be materialized. Zero-width steps (skipping optional units,
+ * \b and \B) depend only on the bytes on either side of the current position.
+ *
+ * All masks exist in forward and in reversed bit order (unit j <-> m-1-j), the
+ * latter for scanning backwards from a match end to its start.
+ */
+#define TRE_DFA_MAX_UNITS   63
+
+typedef struct {
+    uint64_t star;               // units that loop (x*, x+, last unit of x{n,})
+    uint64_t skip;               // optional units that can always be skipped
+    uint64_t look;               // units of x*, x?, x{0,m} that are skipped only
+                                 // if the next byte is an x (see matchhere())
+    uint64_t wordb, nwordb;      // \b and \B units
+} tre_dfa_masks_t;
+
+typedef struct {
+    uint64_t fwd, rev;           // units accepting a byte of this class
+} tre_dfa_class_t;
+
+typedef struct {
+    int m;                       // number of units; bit m = matched
+    int nclass;                  // byte equivalence classes
+    int eol;                     // match must end at the end of the text
+    int lazy;                    // has lazy quantifiers (match end needs the backtracker)
+    int bounds;                  // has \b or \B units
+    tre_dfa_masks_t fwd, rev;
+    unsigned char map[256];      // byte -> class
+    tre_dfa_class_t cls[1];      // nclass entries
+} tre_dfa_t;
+
+struct tre_prog {
+    // Hot: read on every search
+    int flags;                   // TRE_IGNCASE, TRE_DFA
+    int anchored;                // pattern starts with ^
+    tre_inst_t *inst;            // instructions, terminated by TRE_OP_END
+    tre_dfa_t *dfa;              // automaton, or NULL (backtracker only)
+    tre_scan_t scan;             // bytes a match can start with
+    uint64_t need[4];            // bytes every match contains (all of them)
+    int minlen;                  // shortest text a match needs
+    int nany;                    // byte sets a match contains one of
+    uint64_t any[TRE_SIG_SETS][4];
+    tre_tune_t *tune;            // optional self-tuning state
+    tre_cache_t *cache;          // optional result cache
+    tre_shadow_t *shadow;        // optional shadow execution
+    // Cold: sizes and the source, for diagnostics only
+    int ninst;                   // instructions excluding END
+    int ncls;                    // class bitmaps stored in this block
+    int size;                    // bytes used in the caller's block
+    int hot;                     // bytes of the 64-byte aligned hot block (header onwards)
+    int dfasize;                 // bytes of the automaton
+    char *pattern;               // copy of the source pattern, outside the hot block
+};
+
+// What a pattern needs, gathered by the counting pass
+typedef struct {
+    int ninst;                   // instructions (excluding END)
+    int ncls;                    // [...] bitmaps
+    int units;                   // automaton units, > TRE_DFA_MAX_UNITS if too many
+    int dfa_classes;             // upper bound on byte equivalence classes
+} tre_counts_t;
+
+#define TRE_ALIGN(n)   (((n) + 15) & ~15)
+#define TRE_ALIGN64(n) (((n) + 63) & ~63)
+
+/* Parse {n}, {n,} or {n,m} at *re. Returns 1 if found, 0 if absent, -1 if malformed */
+static int parsebraces(const char **re, int *min_rep, int *max_rep) {
+    const char *p = *re;
+    if (*p != '{') return 0;
+    p++;  // skip {
+    int n = 0, m, digits = 0;
+    while (*p >= '0' && *p <= '9') {
+        n = n * 10 + (*p - '0');
+        p++; digits++;
+    }
+    m = n;
+    if (*p == ',' && digits) {
+        p++;  // skip ,
+        if (*p == '}') m = -1;
+        else for (m = 0; *p >= '0' && *p <= '9'; p++) m = m * 10 + (*p - '0');
+    }
+    if (!digits || m == 0 || (m > 0 && m < n) || *p != '}') return -1;
+    *re = p + 1;  // skip }
+    *min_rep = n;
+    *max_rep = m;
+    return 1;
+}
+
+/* Units an instruction expands to in the automaton (see tre_dfa_t) */
+static int inst_units(const tre_inst_t *in) {
+    switch (in->op) {
+        case TRE_OP_END: case TRE_OP_EOL: return 0;
+        case TRE_OP_WORDB: case TRE_OP_NWORDB: return 1;
+    }
+    if (in->max < 0) return in->min > 0 ? in->min : 1;
+    return in->max;
+}
+
+/*
+ * One compiler pass. With prog == NULL it only validates and counts what the
+ * pattern needs; otherwise it fills prog->inst / class storage.
+ */
+static int compile_pass(const char *regexp, int flags, tre_prog_t *prog,
+                        unsigned char (*cls)[32], tre_counts_t *cnt)
+{
+    const char *re = regexp;
+    int n = 0, c = 0;
+
+    memset(cnt, 0, sizeof(*cnt));
+    cnt->dfa_classes = 1;
+    if (*re == '^') re++;
+    while (*re) {
+        tre_inst_t in;
+        memset(&in, 0, sizeof(in));
+        in.pos = (int)(re - regexp);
+        in.min = in.max = 1;
+
+        // Zero-width assertions take no quantifier
+        if (re[0] == '\\' && (re[1] == 'b' || re[1] == 'B')) {
+            in.op = (re[1] == 'b') ? TRE_OP_WORDB : TRE_OP_NWORDB;
+            re += 2;
+        } else if (re[0] == '$' && re[1] == '\0') {
+            in.op = TRE_OP_EOL;
             re++;
+        } else {
+            int negate;
+            const unsigned char *table;
+            if (re[0] == '\\' && re[1] != '\0' && (table = shorthand(re[1], &negate)) != NULL) {
+                in.op = TRE_OP_CLASS;
+                in.set = table;
+                in.neg = (unsigned char)negate;
+                re += 2;
+            } else if (re[0] == '[') {
+                const char *close = strchr(re, ']');
+                if (!close) return TRE_ERROR_MALFORMED_PATTERN;
+                if (prog) {
+                    memset(cls[c], 0, 32);
+                    for (int ch = 0; ch < 256; ch++)
+                        if (matchinclass((char)ch, re + 1, flags & TRE_IGNCASE)) cls[c][ch >> 3] |= (unsigned char)(1 << (ch & 7));
+                    in.set = cls[c];
+                }
+                in.op = TRE_OP_CLASS;
+                c++;
+                re = close + 1;
+            } else if (re[0] == '.') {
+                in.op = TRE_OP_ANY;
+                re++;
+            } else {
+                if (re[0] == '\\' && re[1] != '\0') re++;   // escaped literal
+                in.op = TRE_OP_CHAR;
+                in.ch = (unsigned char)((flags & TRE_IGNCASE) ? tolower((unsigned char)re[0]) : re[0]);
+                re++;
+            }
+
+            // Repetition: {n}, {n,}, {n,m}, or * / + / ?, optionally lazy
+            int braced = parsebraces(&re, &in.min, &in.max);
+            if (braced < 0) return TRE_ERROR_MALFORMED_PATTERN;
+            if (*re == '*' || *re == '+' || (*re == '?' && !braced)) {
+                if (*re == '*') { in.min = 0; in.max = -1; }
+                if (*re == '+') { in.min = 1; in.max = -1; }
+                if (*re == '?') { in.min = 0; in.max =  1; }
+                re++;
+                braced = 1;
+            }
+            if (braced && *re == '?') { in.lazy = 1; re++; }
+
+            // Each literal splits off at most two byte classes, each set at most doubles them
+            if (in.op == TRE_OP_CHAR)       cnt->dfa_classes += 2;
+            else if (in.op == TRE_OP_CLASS) cnt->dfa_classes *= 2;
+            if (cnt->dfa_classes > 256) cnt->dfa_classes = 256;
+        }
+
+        if (n >= tre_max_program_size) return TRE_ERROR_PATTERN_TOO_LONG;
+        if (cnt->units <= TRE_DFA_MAX_UNITS) cnt->units += inst_units(&in);
+        if (prog) prog->inst[n] = in;
+        n++;
+    }
+    if (prog) {
+        memset(&prog->inst[n], 0, sizeof(tre_inst_t));
+        prog->inst[n].op = TRE_OP_END;
+        prog->inst[n].pos = (int)(re - regexp);
+    }
+    cnt->ninst = n;
+    cnt->ncls = c;
+    return TRE_OK;
+}
+
+static int dfa_bytes(const tre_counts_t *cnt, int flags) {
+    if (!(flags & TRE_DFA) || cnt->units > TRE_DFA_MAX_UNITS) return 0;
+    return TRE_ALIGN((int)sizeof(tre_dfa_t) + (cnt->dfa_classes - 1) * (int)sizeof(tre_dfa_class_t));
+}
+
+/* Hot block: header, instructions, automaton and (unless shared) class bitmaps, in whole cache lines */
+static int hot_bytes(const tre_counts_t *cnt, int flags, int own_cls) {
+    return TRE_ALIGN64(TRE_ALIGN64((int)sizeof(tre_prog_t))
+                       + TRE_ALIGN((cnt->ninst + 1) * (int)sizeof(tre_inst_t))
+                       + dfa_bytes(cnt, flags) + (own_cls ? cnt->ncls * 32 : 0));
+}
+
+static int prog_bytes(const tre_counts_t *cnt, int flags, int patlen) {
+    return 63 + hot_bytes(cnt, flags, 1) + patlen + 1;     // alignment slack, hot block, pattern copy
+}
+
+/* Does the instruction accept byte c? (igncase as compiled) */
+static int inst_accepts(const tre_prog_t *prog, const tre_inst_t *in, int c) {
+    switch (in->op) {
+        case TRE_OP_CHAR:
+            return ((prog->flags & TRE_IGNCASE) ? tolower(c) : c) == in->ch;
+        case TRE_OP_ANY:   return 1;
+        case TRE_OP_CLASS: return TRE_INTABLE(in->set, c) != in->neg;
+    }
+    return 0;
+}
+
+/* Mirror the low m bits: unit j <-> unit m-1-j (bit m, "matched", stays put) */
+static uint64_t dfa_mirror(uint64_t v, int m) {
+    uint64_t r = v & ((uint64_t)1 << m);
+    for (int j = 0; j < m; j++)
+        if (v >> j & 1) r |= (uint64_t)1 << (m - 1 - j);
+    return r;
+}
+
+static void dfa_mirror_masks(tre_dfa_masks_t *rev, const tre_dfa_masks_t *fwd, int m) {
+    rev->star   = dfa_mirror(fwd->star, m);
+    rev->skip   = dfa_mirror(fwd->skip, m);
+    rev->look   = dfa_mirror(fwd->look, m);
+    rev->wordb  = dfa_mirror(fwd->wordb, m);
+    rev->nwordb = dfa_mirror(fwd->nwordb, m);
+}
+
+/* Expand the instructions into units and group bytes by the units accepting them */
+static void build_dfa(tre_prog_t *prog, tre_dfa_t *dfa)
+{
+    uint64_t accepts[256];
+    int m = 0;
+
+    memset(dfa, 0, sizeof(*dfa));
+    memset(accepts, 0, sizeof(accepts));
+    for (const tre_inst_t *in = prog->inst; in->op != TRE_OP_END; in++) {
+        if (in->op == TRE_OP_EOL)    { dfa->eol = 1; continue; }
+        if (in->op == TRE_OP_WORDB)  { dfa->fwd.wordb  |= (uint64_t)1 << m++; continue; }
+        if (in->op == TRE_OP_NWORDB) { dfa->fwd.nwordb |= (uint64_t)1 << m++; continue; }
+        if (in->lazy) dfa->lazy = 1;
+
+        int first = m, units = inst_units(in);
+        for (int u = 0; u < units; u++, m++) {
+            for (int c = 0; c < 256; c++)
+                if (inst_accepts(prog, in, c)) accepts[c] |= (uint64_t)1 << m;
+            if (u >= in->min && u > 0) dfa->fwd.skip |= (uint64_t)1 << m;
+        }
+        if (in->min == 0) dfa->fwd.look |= (uint64_t)1 << first;
+        if (in->max < 0)  dfa->fwd.star |= (uint64_t)1 << (m - 1);
+    }
+    dfa->m = m;
+    dfa->bounds = (dfa->fwd.wordb | dfa->fwd.nwordb) != 0;
+    dfa_mirror_masks(&dfa->rev, &dfa->fwd, m);
+
+    // Byte equivalence classes: bytes accepted by the same units share one
+    for (int c = 0; c < 256; c++) {
+        int k;
+        for (k = 0; k < dfa->nclass && dfa->cls[k].fwd != accepts[c]; k++) ;
+        if (k == dfa->nclass) {
+            tre_dfa_class_t *cl = &dfa->cls[k];
+            cl->fwd = accepts[c];
+            cl->rev = dfa_mirror(accepts[c], m);
+            dfa->nclass++;
+        }
+        dfa->map[c] = (unsigned char)k;
+    }
+}
+
+/*
+ * Start bytes, from the first atom. Only for patterns starting with a consuming
+ * atom: skipped positions would not have got past it, so counters and limits
+ * see exactly the same work as without scanning.
+ */
+static void build_scan(tre_prog_t *prog)
+{
+    const tre_inst_t *in = prog->inst;
+    unsigned char set[32];
+
+    memset(&prog->scan, 0, sizeof(prog->scan));
+    if (prog->anchored || (in->op != TRE_OP_CHAR && in->op != TRE_OP_CLASS)) return;
+    memset(set, 0, sizeof(set));
+    for (int c = 0; c < 256; c++)
+        if (inst_accepts(prog, in, c)) set[c >> 3] |= (unsigned char)(1 << (c & 7));
+    scan_init(&prog->scan, set);
+}
+
+/*
+ * Required bytes for tre_sig_reject(): every consuming atom has to see a byte it
+ * accepts, x* and x? included. Single-byte atoms go into need, the most
+ * selective of the other sets into any. minlen adds up the minimum repeats,
+ * and is at least 1 if there is any consuming atom (its byte has to be there).
+ */
+static void build_sig(tre_prog_t *prog)
+{
+    memset(prog->need, 0, sizeof(prog->need));
+    prog->nany = 0;
+    prog->minlen = 0;
+    for (const tre_inst_t *in = prog->inst; in->op != TRE_OP_END; in++) {
+        uint64_t set[4] = { 0, 0, 0, 0 };
+        int count = 0, last = 0;
+        if (in->op == TRE_OP_CHAR || in->op == TRE_OP_ANY || in->op == TRE_OP_CLASS)
+            prog->minlen += in->min;
+        if (in->op != TRE_OP_CHAR && in->op != TRE_OP_CLASS) continue;
+        for (int c = 0; c < 256; c++)
+            if (inst_accepts(prog, in, c)) {
+                set[c >> 6] |= (uint64_t)1 << (c & 63);
+                count++;
+                last = c;
+            }
+        if (count == 0 || count == 256) continue;   // never / always satisfied: nothing to test
+        if (count == 1) {
+            prog->need[last >> 6] |= (uint64_t)1 << (last & 63);
+            continue;
         }
-        if (n == 0 || *re != '}') { // invalid → treat as literal or fail
-            if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
-            *regexp_ptr = start_re;
-            return 0;
+
+        // Keep the TRE_SIG_SETS smallest sets (fewest bytes = rarest in text)
+        int slot = prog->nany;
+        if (slot == TRE_SIG_SETS) {
+            int worst = 0, worst_count = 0;
+            for (int k = 0; k < TRE_SIG_SETS; k++) {
+                int n = 0;
+                for (int w = 0; w < 4; w++) n += __builtin_popcountll(prog->any[k][w]);
+                if (n > worst_count) { worst = k; worst_count = n; }
+            }
+            if (count >= worst_count) continue;
+            slot = worst;
+        } else {
+            prog->nany++;
         }
-        re++;           // skip }
-        *repeat_count = n;
+        memcpy(prog->any[slot], set, sizeof(set));
+    }
+    for (const tre_inst_t *in = prog->inst; prog->minlen == 0 && in->op != TRE_OP_END; in++)
+        if (in->op == TRE_OP_CHAR || in->op == TRE_OP_ANY || in->op == TRE_OP_CLASS) prog->minlen = 1;
+}
+
+/* Validate regexp and count what it needs; sets tre_last_error, returns bytes or -1 */
+static int compile_measure(const char *regexp, int flags, tre_counts_t *cnt)
+{
+    tre_last_error = TRE_OK;
+    if (!regexp) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    int err = compile_pass(regexp, flags, NULL, NULL, cnt);
+    if (err != TRE_OK) {
+        tre_last_error = err;
+        return -1;
+    }
+    return prog_bytes(cnt, flags, (int)strlen(regexp));
+}
+
+int tre_compile_size(const char *regexp, int flags)
+{
+    tre_counts_t cnt;
+    return compile_measure(regexp, flags, &cnt);
+}
+
+/*
+ * Lay out and fill a program in the block at mem (size bytes from prog_bytes()).
+ * Class bitmaps go into the block, or into cls if given (set compilation interns
+ * them afterwards); the pattern copy goes after the hot block, or to cold if given.
+ * Touches no globals, so sets can compile in parallel.
+ */
+static tre_prog_t *compile_into(const char *regexp, int flags, tre_counts_t *cnt,
+                                void *mem, int size, unsigned char (*cls)[32], char *cold)
+{
+    // Carve the hot block on a cache line: header, instructions, automaton, classes
+    unsigned char *p = (unsigned char *)mem;
+    p += (64 - ((size_t)p & 63)) & 63;
+    tre_prog_t *prog = (tre_prog_t *)p;
+    memset(prog, 0, sizeof(*prog));
+    p += TRE_ALIGN64((int)sizeof(tre_prog_t));
+    prog->inst = (tre_inst_t *)p;
+    p += TRE_ALIGN((cnt->ninst + 1) * (int)sizeof(tre_inst_t));
+    prog->dfasize = dfa_bytes(cnt, flags);
+    tre_dfa_t *dfa = prog->dfasize ? (tre_dfa_t *)p : NULL;
+    p += prog->dfasize;
+    if (!cls) {
+        cls = (unsigned char (*)[32])p;
+        p += cnt->ncls * 32;
     }
-    *regexp_ptr = re;
-    return 1;  // matched one character
+    prog->hot = TRE_ALIGN64((int)(p - (unsigned char *)prog));
+
+    // Cold: the pattern copy, read only by diagnostics
+    prog->pattern = cold ? cold : (char *)prog + prog->hot;
+    strcpy(prog->pattern, regexp);
+
+    compile_pass(regexp, flags, prog, cls, cnt);
+    prog->ninst = cnt->ninst;
+    prog->ncls = cnt->ncls;
+    prog->flags = flags;
+    prog->anchored = (regexp[0] == '^');
+    prog->size = size;
+    if (dfa) {
+        build_dfa(prog, dfa);
+        prog->dfa = dfa;
+    }
+    build_scan(prog);
+    build_sig(prog);
+    return prog;
+}
+
+tre_prog_t* tre_compile(const char *regexp, int flags, void *mem, int memsize)
+{
+    tre_counts_t cnt;
+    int size = compile_measure(regexp, flags, &cnt);
+    if (size < 0) return NULL;
+    if (!mem || memsize < size) {
+        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+        return NULL;
+    }
+    TRE_PROF_FORGET();
+    return compile_into(regexp, flags, &cnt, mem, size, NULL, NULL);
+}
+
+int tre_prog_engine(const tre_prog_t *prog)
+{
+    return prog->dfa ? TRE_ENGINE_DFA : TRE_ENGINE_BACKTRACK;
+}
+
+void tre_prog_tune(tre_prog_t *prog, tre_tune_t *tune)
+{
+    prog->tune = tune;
+}
+
+void tre_prog_footprint(const tre_prog_t *prog, tre_footprint_t *fp)
+{
+    fp->hot = prog->hot;
+    fp->header = (int)sizeof(tre_prog_t);
+    fp->inst = (prog->ninst + 1) * (int)sizeof(tre_inst_t);
+    fp->dfa = prog->dfasize;
+    fp->classes = prog->ncls * 32;
+    fp->cold = (int)strlen(prog->pattern) + 1;
+    fp->total = prog->size;
+}
+
+// ─────────────────────────────────────────────────────
+// Backtracking executor
+// ─────────────────────────────────────────────────────
+
+// Returns: number of chars matched in text (0 or 1) by the atom at pc
+static inline int matchoneatom(const tre_inst_t *pc, const char *text)
+{
+    TRE_PROF(TRE_TRACE_EXEC, pc, text);
+    if (text == tre_text_end) return 0;
+
+    unsigned char c = (unsigned char)*text;
+    switch (pc->op) {
+        case TRE_OP_CHAR:  return (tre_igncase ? (unsigned char)tolower(c) : c) == pc->ch;
+        case TRE_OP_ANY:   return 1;
+        case TRE_OP_CLASS: return TRE_INTABLE(pc->set, c) != pc->neg;
+    }
+    return 0;
 }
 
-/* matchhere: match regexp at the beginning of text */
-static char* matchhere(char *regexp, char *text, int *outlen, int depth)
+/* matchhere: match the program at pc against the beginning of text */
+static const char* matchhere(const tre_inst_t *pc, const char *text, int *outlen, int depth)
 {
     if (outlen) *outlen = 0;
+    TRE_STACK_SAMPLE();
+    if (depth > tre_call_depth)       tre_call_depth = depth;
     if (depth > tre_peak_recursion)   tre_peak_recursion = depth;
     if (depth > tre_max_depth) {
         if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_RECURSION_DEPTH;
         return NULL;
     }
-    if (regexp[0] == '\0') return text;
 
-    // $ : end of string (only when it's the last thing in the pattern)
-    if (regexp[0] == '$' && regexp[1] == '\0') {
-        if (*text == '\0') return text;
-        return NULL;
+    switch (pc->op) {
+        case TRE_OP_END:
+            return text;
+
+        // $ : end of string (only when it's the last thing in the pattern)
+        case TRE_OP_EOL:
+            return (text == tre_text_end) ? text : NULL;
+
+        // \b / \B : zero-width word boundary assertions
+        case TRE_OP_WORDB:
+        case TRE_OP_NWORDB:
+            TRE_PROF(TRE_TRACE_EXEC, pc, text);
+            if (matchboundary(text) != (pc->op == TRE_OP_WORDB)) return NULL;
+            return matchhere(pc + 1, text, outlen, depth + 1);
     }
 
-    char *next_re = regexp;
-    int repeat_count;
-    int consumed = matchoneatom(&next_re, text, &repeat_count);
+    int consumed = matchoneatom(pc, text);
     if (consumed == 0) return NULL;  // atom didn't match
 
+    int min_rep = pc->min;
+    int max_rep = pc->max;
+    const char *start = text;
+    int count;
+
     // ─────────────────────────────────────────────────────
-    // Now handle repetition — either {n} or * / + / ?
+    // Lazy repetition (stop at the first acceptable end)
     // ─────────────────────────────────────────────────────
-    char *after_quant = next_re;
-    int min_rep = repeat_count;  // usually 1, or n from {n}
-    int max_rep = repeat_count;  // same for exact count
-
-    char q = next_re[0];
-    if (q == '*' || q == '+' || q == '?') {
-        if (q == '*') { min_rep = 0; max_rep = -1; }
-        if (q == '+') { min_rep = 1; max_rep = -1; }
-        if (q == '?') { min_rep = 0; max_rep =  1; }
-        after_quant++;
-    } else if (q == '{') {
-        // We already parsed {n} in matchoneatom → nothing more to do here
-        // repeat_count is already set to n
-        after_quant++;  // skip past the {n} we already consumed
+    if (pc->lazy) {
+        for (count = 0; ; count++) {
+            if (count >= min_rep) {
+                int rest_len = 0;
+                const char *res = matchhere(pc + 1, text, &rest_len, depth + 1);
+                if (res) {
+                    if (outlen) *outlen = (int)((text - start) + rest_len);
+                    return start;
+                }
+                TRE_PROF(TRE_TRACE_BACKTRACK, pc, text);
+            }
+            if (max_rep >= 0 && count >= max_rep) return NULL;
+            if (++tre_backtrack_steps > tre_peak_backtrack)   tre_peak_backtrack = tre_backtrack_steps;
+            if (tre_backtrack_steps > tre_max_backtrack_steps) {
+                if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_BACKTRACK_LIMIT;
+                return NULL;
+            }
+            // Take one more repetition (the first was already tried above)
+            int probe = count == 0 ? consumed : matchoneatom(pc, text);
+            if (probe == 0) return NULL;
+            text += probe;
+        }
     }
 
     // ─────────────────────────────────────────────────────
     // Greedy repetition (eat as many as possible)
     // ─────────────────────────────────────────────────────
-    char *start = text;
     text += consumed;
-    int count = 1;  // we already matched one
+    count = 1;  // we already matched one
 
     // Consume more repetitions greedily
-    while ((max_rep < 0 || count < max_rep) && *text != '\0') {
+    while ((max_rep < 0 || count < max_rep) && text != tre_text_end) {
         if (++tre_backtrack_steps > tre_peak_backtrack)   tre_peak_backtrack = tre_backtrack_steps;
         if (tre_backtrack_steps > tre_max_backtrack_steps) {
             if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_BACKTRACK_LIMIT;
             return NULL;
         }
 
-        char *probe_re = regexp;           // reset to beginning of repeated atom
-        int probe_rep;
-        int probe = matchoneatom(&probe_re, text, &probe_rep);
+        int probe = matchoneatom(pc, text);
         if (probe == 0) break;
         text += probe;
         count++;
@@ -162,11 +1010,12 @@ static char* matchhere(char *regexp, char *text, int *outlen, int depth)
     // Backtrack from max down to min_rep
     while (count >= min_rep) {
         int rest_len = 0;
-        char *res = matchhere(after_quant, text, &rest_len, depth + 1);
+        const char *res = matchhere(pc + 1, text, &rest_len, depth + 1);
         if (res) {
             if (outlen) *outlen = (int)((text - start) + rest_len);
             return start;
         }
+        TRE_PROF(TRE_TRACE_BACKTRACK, pc, text);
         if (++tre_backtrack_steps > tre_peak_backtrack)   tre_peak_backtrack = tre_backtrack_steps;
         if (tre_backtrack_steps > tre_max_backtrack_steps) {
             if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_BACKTRACK_LIMIT;
@@ -180,47 +1029,3012 @@ static char* matchhere(char *regexp, char *text, int *outlen, int depth)
     return NULL;
 }
 
-/* match: search for regexp anywhere in text (unless ^) */
-char* match(char *regexp, char *text, int *length, int igncase, int direction)
+// ─────────────────────────────────────────────────────
+// Three-phase DFA search (TRE_DFA programs)
+//
+// 1. forward scan, starting a thread at every position:
+//    the earliest position any match ends at
+// 2. reverse scan from that end: the leftmost start
+// 3. forward scan anchored at the start: the match length
+//    (greedy = longest here; lazy patterns use matchhere())
+// ─────────────────────────────────────────────────────
+
+// Add every unit reachable through a run of skippable units (one carry chain per run)
+#define TRE_DFA_CLOSE(d, s)   ((d) | ((((d) & (s)) + (s)) ^ (s)))
+
+/* Units that can be skipped at position p of the text, forward or reverse bit order */
+static inline uint64_t dfa_skip(const tre_dfa_t *dfa, const tre_dfa_masks_t *mk, int rev,
+                                const unsigned char *text, int p, int n)
 {
-    tre_last_error = TRE_OK;
-    if (length) *length = 0;
+    uint64_t s = mk->skip;
+    if (p < n) {    // at the end there is nothing left for x* / x? to look at
+        const tre_dfa_class_t *cl = &dfa->cls[dfa->map[text[p]]];
+        s |= mk->look & (rev ? cl->rev : cl->fwd);
+    }
+    if (dfa->bounds) {
+        int before = p > 0 && TRE_INTABLE(tre_class_word, text[p - 1]);
+        int after  = p < n && TRE_INTABLE(tre_class_word, text[p]);
+        s |= (before != after) ? mk->wordb : mk->nwordb;
+    }
+    return s;
+}
 
-    if (!regexp || !text) {
-        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
-        return NULL;
+/* Consume byte c: units accepting it advance, looping units may also stay */
+static inline uint64_t dfa_step(const tre_dfa_t *dfa, const tre_dfa_masks_t *mk, int rev,
+                                uint64_t d, unsigned char c)
+{
+    const tre_dfa_class_t *cl = &dfa->cls[dfa->map[c]];
+    uint64_t hit = d & (rev ? cl->rev : cl->fwd);
+    return (hit << 1) | (hit & mk->star);
+}
+
+/* Phase 1: earliest end of any match starting in [0, last_start], or -1 */
+static int dfa_first_end(const tre_prog_t *prog, const unsigned char *text, int n, int last_start)
+{
+    const tre_dfa_t *dfa = prog->dfa;
+    const uint64_t done = (uint64_t)1 << dfa->m;
+    uint64_t d = 0;
+
+    for (int p = 0; ; p++) {
+        if (!d && prog->scan.kind != TRE_SCAN_NONE) {    // no match in progress: skip to a start byte
+            const char *at = (const char *)text + p;
+            p += (int)(scan_start(&prog->scan, at, (const char *)text + n) - at);
+            if (p == n) return -1;
+        }
+        if (p <= last_start) d |= 1;
+        d = TRE_DFA_CLOSE(d, dfa_skip(dfa, &dfa->fwd, 0, text, p, n));
+        if ((d & done) && (!dfa->eol || p == n)) return p;
+        if (p == n) return -1;
+        d = dfa_step(dfa, &dfa->fwd, 0, d, text[p]);
+        if (!d && p >= last_start) return -1;
     }
-    // Check pattern length limit
-    if ((int)strlen(regexp) > tre_max_pattern_length) {
-        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+}
+
+/* Phase 2: smallest start of a match ending at end (which must exist) */
+static int dfa_first_start(const tre_dfa_t *dfa, const unsigned char *text, int n, int end)
+{
+    const uint64_t done = (uint64_t)1 << dfa->m;
+    uint64_t d = 1;
+    int start = end;
+
+    for (int p = end; ; p--) {
+        d = TRE_DFA_CLOSE(d, dfa_skip(dfa, &dfa->rev, 1, text, p, n));
+        if (d & done) start = p;
+        if (p == 0) break;
+        d = dfa_step(dfa, &dfa->rev, 1, d, text[p - 1]);
+        if (!d) break;
+    }
+    return start;
+}
+
+/* Rightmost start of any match (direction -1), or -1 */
+static int dfa_last_start(const tre_dfa_t *dfa, const unsigned char *text, int n)
+{
+    const uint64_t done = (uint64_t)1 << dfa->m;
+    uint64_t d = 0;
+
+    for (int p = n; ; p--) {
+        if (!dfa->eol || p == n) d |= 1;
+        d = TRE_DFA_CLOSE(d, dfa_skip(dfa, &dfa->rev, 1, text, p, n));
+        if (d & done) return p;
+        if (p == 0) return -1;
+        d = dfa_step(dfa, &dfa->rev, 1, d, text[p - 1]);
+        if (!d && dfa->eol) return -1;
+    }
+}
+
+/* Phase 3: length of the longest match starting at start (which must exist) */
+static int dfa_longest(const tre_dfa_t *dfa, const unsigned char *text, int n, int start)
+{
+    const uint64_t done = (uint64_t)1 << dfa->m;
+    uint64_t d = 1;
+    int len = 0;
+
+    for (int p = start; ; p++) {
+        d = TRE_DFA_CLOSE(d, dfa_skip(dfa, &dfa->fwd, 0, text, p, n));
+        if ((d & done) && (!dfa->eol || p == n)) len = p - start;
+        if (p == n) break;
+        d = dfa_step(dfa, &dfa->fwd, 0, d, text[p]);
+        if (!d) break;
+    }
+    return len;
+}
+
+static char* dfa_execute(tre_prog_t *prog, const char *text, int textlen, int *length, int direction)
+{
+    const tre_dfa_t *dfa = prog->dfa;
+    const unsigned char *t = (const unsigned char *)text;
+    int start;
+
+    if (prog->anchored) {
+        start = (dfa_first_end(prog, t, textlen, 0) < 0) ? -1 : 0;
+    } else if (direction == -1) {
+        start = dfa_last_start(dfa, t, textlen);
+    } else {
+        int end = dfa_first_end(prog, t, textlen, textlen);
+        start = (end < 0) ? -1 : dfa_first_start(dfa, t, textlen, end);
+    }
+    if (start < 0) {
+        tre_last_error = TRE_ERROR_NO_MATCH;
         return NULL;
     }
+    if (length) {
+        if (dfa->lazy) return (char *)matchhere(prog->inst, text + start, length, 0);
+        *length = dfa_longest(dfa, t, textlen, start);
+    }
+    return (char *)text + start;
+}
+
+/* Search [text, text+textlen) with the limits currently in the globals */
+static char* execute(tre_prog_t *prog, const char *text, int textlen, int *length, int direction)
+{
+    const tre_inst_t *pc = prog->inst;
+    const char *end = text + textlen;
+
     // Set global configuration for internal use (performance optimization)
-    tre_igncase = igncase;
+    tre_igncase = (prog->flags & TRE_IGNCASE) && !tre_text_folded;
+    tre_text_start = (tre_text_origin && tre_text_origin < text) ? tre_text_origin : text;
+    tre_text_end = end;
 
     // Reset backtrack step counter for this match operation
     tre_backtrack_steps = 0;
+    tre_call_depth = 0;
+    TRE_PROF_START(prog);
+    TRE_STACK_START();
 
-    if (regexp[0] == '^') {
-        char *res = matchhere(regexp + 1, text, length, 0);
+    // The automaton only sees [text, end): with \b and context before, take the backtracker
+    if (prog->dfa && !(prog->dfa->bounds && tre_text_start < text))
+        return dfa_execute(prog, text, textlen, length, direction);
+    if (prog->anchored) {
+        const char *res = matchhere(pc, text, length, 0);
         if (!res && tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_NO_MATCH;
-        return res;
+        return (char *)res;
     }
     if (direction == -1) {
-        char *p = text + strlen(text);
+        const char *p = end;
         while (p >= text) {
-            char *res = matchhere(regexp, p, length, 0);
-            if (res) return res;
+            const char *res = matchhere(pc, p, length, 0);
+            if (res) return (char *)res;
             if (p == text) break;
             p--;
         }
+    } else if (prog->scan.kind != TRE_SCAN_NONE) {
+        for (const char *p = text; (p = scan_start(&prog->scan, p, end)) != end; p++) {
+            const char *res = matchhere(pc, p, length, 0);
+            if (res) return (char *)res;
+        }
     } else {
-        char *p = text;
+        const char *p = text;
         do {
-            char *res = matchhere(regexp, p, length, 0);
-            if (res) return res;
-        } while (*p++);
+            const char *res = matchhere(pc, p, length, 0);
+            if (res) return (char *)res;
+        } while (p++ != end);
     }
     if (tre_last_error == TRE_OK) tre_last_error = TRE_ERROR_NO_MATCH;
     return NULL;
 }
+
+static void tune_record(tre_tune_t *tune);
+static void tune_apply(tre_tune_t *tune, int *saved_steps, int *saved_depth);
+static int  cache_lookup(tre_cache_t *cache, const char *text, int textlen, int direction,
+                         uint64_t *key, char **res, int *length);
+static void cache_store(tre_cache_t *cache, uint64_t key, int textlen, int direction,
+                        const char *text, const char *res, int length);
+static char* execute_shadow(tre_prog_t *prog, const char *text, int textlen, int *length, int direction);
+
+/* execute() under the program's self-tuning, if any */
+static char* execute_tuned(tre_prog_t *prog, const char *text, int textlen, int *length, int direction)
+{
+    if (!prog->tune) return execute(prog, text, textlen, length, direction);
+
+    char *res;
+    if (prog->tune->max_steps == 0) {
+        res = execute(prog, text, textlen, length, direction);
+        tune_record(prog->tune);
+    } else {
+        int saved_steps, saved_depth;
+        tune_apply(prog->tune, &saved_steps, &saved_depth);
+        res = execute(prog, text, textlen, length, direction);
+        tre_max_backtrack_steps = saved_steps;
+        tre_max_depth = saved_depth;
+    }
+    return res;
+}
+
+char* tre_execn(tre_prog_t *prog, const char *text, int textlen, int *length, int direction)
+{
+    tre_last_error = TRE_OK;
+    if (length) *length = 0;
+
+    if (!prog || !text || textlen < 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return NULL;
+    }
+    if (!prog->cache && !prog->shadow) return execute_tuned(prog, text, textlen, length, direction);
+
+    uint64_t key = 0;
+    char *res;
+    int len = 0;
+    if (!prog->cache || !cache_lookup(prog->cache, text, textlen, direction, &key, &res, &len)) {
+        if (prog->shadow) res = execute_shadow(prog, text, textlen, &len, direction);
+        else              res = execute_tuned(prog, text, textlen, &len, direction);
+        if (prog->cache) cache_store(prog->cache, key, textlen, direction, text, res, len);
+    }
+    if (length) *length = len;
+    return res;
+}
+
+char* tre_exec(tre_prog_t *prog, const char *text, int *length, int direction)
+{
+    return tre_execn(prog, text, text ? (int)strlen(text) : 0, length, direction);
+}
+
+// ─────────────────────────────────────────────────────
+// Delimited fields: find the span with a vector byte
+// count, then search it in place
+// ─────────────────────────────────────────────────────
+
+/* Position of the k-th (from 0) delim at or after p, or end */
+static const char *find_delim_scalar(const char *p, const char *end, char delim, int k)
+{
+    for (; p < end; p++)
+        if (*p == delim && k-- == 0) return p;
+    return end;
+}
+
+#ifdef TRE_X86
+/* Index of the k-th set bit of mask (k < popcount) */
+static inline int nth_bit(uint64_t mask, int k)
+{
+    while (k--) mask &= mask - 1;
+    return __builtin_ctzll(mask);
+}
+
+__attribute__((target("sse2")))
+static const char *find_delim_sse2(const char *p, const char *end, char delim, int k)
+{
+    const __m128i d = _mm_set1_epi8(delim);
+    for (; end - p >= 16; p += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), d));
+        int n = __builtin_popcount(mask);
+        if (k < n) return p + nth_bit(mask, k);
+        k -= n;
+    }
+    return find_delim_scalar(p, end, delim, k);
+}
+
+__attribute__((target("avx2")))
+static const char *find_delim_avx2(const char *p, const char *end, char delim, int k)
+{
+    const __m256i d = _mm256_set1_epi8(delim);
+    for (; end - p >= 32; p += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), d));
+        int n = __builtin_popcount(mask);
+        if (k < n) return p + nth_bit(mask, k);
+        k -= n;
+    }
+    return find_delim_scalar(p, end, delim, k);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *find_delim_avx512(const char *p, const char *end, char delim, int k)
+{
+    const __m512i d = _mm512_set1_epi8(delim);
+    for (; end - p >= 64; p += 64) {
+        uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)p), d);
+        int n = __builtin_popcountll(mask);
+        if (k < n) return p + nth_bit(mask, k);
+        k -= n;
+    }
+    return find_delim_avx2(p, end, delim, k);
+}
+#endif
+
+static const char *find_delim(const char *p, const char *end, char delim, int k)
+{
+    switch (tre_simd_level()) {
+#ifdef TRE_X86
+        case TRE_SIMD_AVX512: return find_delim_avx512(p, end, delim, k);
+        case TRE_SIMD_AVX2:   return find_delim_avx2(p, end, delim, k);
+        case TRE_SIMD_SSE2:   return find_delim_sse2(p, end, delim, k);
+#endif
+        default:              return find_delim_scalar(p, end, delim, k);
+    }
+}
+
+char* tre_match_field(tre_prog_t *prog, const char *line, int linelen, char delim, int field, int *length)
+{
+    if (length) *length = 0;
+    if (!prog || !line || linelen < 0 || field < 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return NULL;
+    }
+    const char *end = line + linelen;
+    const char *start = line;
+    if (field > 0) {
+        start = find_delim(line, end, delim, field - 1);
+        if (start == end) {                 // fewer fields than that
+            tre_last_error = TRE_ERROR_NO_MATCH;
+            return NULL;
+        }
+        start++;
+    }
+    const char *stop = find_delim(start, end, delim, 0);
+    return tre_execn(prog, start, (int)(stop - start), length, 1);
+}
+
+/* Lines of [buf, buf+buflen) through tre_match_field(); *stop set when fn asks to stop */
+static int scan_lines(tre_prog_t *prog, const char *buf, int buflen, char delim, int field,
+                      tre_line_fn fn, void *user, int *stop)
+{
+    const char *end = buf + buflen;
+    int matched = 0;
+    for (const char *line = buf; line < end; ) {
+        const char *nl = find_delim(line, end, '\n', 0);
+        int len = (int)(nl - line);
+        if (len > 0 && line[len - 1] == '\r') len--;
+
+        int mlen;
+        char *m = tre_match_field(prog, line, len, delim, field, &mlen);
+        if (!m && tre_last_error != TRE_ERROR_NO_MATCH) return -1;   // cut off by a limit
+        if (m) {
+            matched++;
+            if (fn && fn(line, len, m, mlen, user)) {
+                *stop = 1;
+                break;
+            }
+        }
+        line = nl + 1;
+    }
+    return matched;
+}
+
+int tre_scan_lines(tre_prog_t *prog, const char *buf, int buflen, char delim, int field,
+                   tre_line_fn fn, void *user)
+{
+    if (!prog || !buf || buflen < 0 || field < 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    int stop = 0;
+    int matched = scan_lines(prog, buf, buflen, delim, field, fn, user, &stop);
+    if (matched >= 0) tre_last_error = TRE_OK;
+    return matched;
+}
+
+// ─────────────────────────────────────────────────────
+// File sets: io_uring keeps reads in flight (raw
+// syscalls, no liburing) while the calling thread
+// matches the buffers already read; pread() elsewhere
+//
+// Buffers are recycled in read order, so chunk k of a
+// file is matched right after chunk k-1 and the partial
+// last line simply carries over into the next buffer.
+// ─────────────────────────────────────────────────────
+
+// One pool buffer and the read it holds
+typedef struct {
+    int       fd;
+    int       file;         // index into paths
+    long long off;
+    char     *buf;
+    int       want;         // bytes asked for
+    int       got;          // bytes read, or -errno; a short read is continued until want
+    int       done;
+    int       last;         // last chunk of its file (closes fd)
+} tre_io_slot_t;
+
+static int files_nbufs(int depth)               { return depth + 1; }   // one more is being matched
+static int files_stride(int chunk, int overlap) { return TRE_ALIGN64(overlap) + TRE_ALIGN64(chunk); }
+
+int tre_files_bytes(int depth, int chunk, int overlap)
+{
+    if (depth < 1 || chunk < 1 || overlap < 0) return -1;
+    int n = files_nbufs(depth);
+    return 63 + TRE_ALIGN64(n * (int)sizeof(tre_io_slot_t)) + TRE_ALIGN64(overlap)
+         + n * files_stride(chunk, overlap);
+}
+
+int tre_files_init(tre_files_t *io, int depth, int chunk, int overlap, void *mem, int memsize)
+{
+    memset(io, 0, sizeof(*io));
+    int need = tre_files_bytes(depth, chunk, overlap);
+    if (need < 0 || !mem || memsize < need) return -1;
+    io->depth = depth;
+    io->chunk = chunk;
+    io->overlap = TRE_ALIGN64(overlap);
+    io->mem = mem;
+    return 0;
+}
+
+#ifdef TRE_URING
+typedef struct {
+    int                  fd;
+    unsigned            *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_map, *cq_map;
+    size_t               sq_len, cq_len, sqe_len;
+    unsigned             queued;       // written to the SQ, not yet handed to the kernel
+    int                  max_read;     // largest read per SQE (tre_files_t.max_read), 0 = any
+} tre_uring_t;
+
+static int uring_open(tre_uring_t *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) return -1;               // no io_uring (old kernel, seccomp): caller falls back
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = 0;
+    }
+    r->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = r->cq_len ? mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING)
+                          : r->sq_map;
+    r->sqes = mmap(NULL, r->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_len);
+        if (r->cq_len && r->cq_map != MAP_FAILED) munmap(r->cq_map, r->cq_len);
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqe_len);
+        close(r->fd);
+        return -1;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_close(tre_uring_t *r)
+{
+    munmap(r->sqes, r->sqe_len);
+    if (r->cq_len) munmap(r->cq_map, r->cq_len);
+    munmap(r->sq_map, r->sq_len);
+    close(r->fd);
+}
+
+/* Queue a read; the ring never holds more than depth + 1 of them (one per slot) */
+static void uring_read(tre_uring_t *r, int fd, void *buf, int len, long long off, unsigned slot)
+{
+    if (r->max_read > 0 && len > r->max_read) len = r->max_read;
+    unsigned tail = *r->sq_tail, idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    sqe->off = (uint64_t)off;
+    sqe->user_data = slot;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+/*
+ * Account every posted completion. A short read is continued from where it
+ * stopped (if more), like read_full(); a slot is done at want bytes, end of file
+ * or an error.
+ */
+static void uring_reap(tre_uring_t *r, tre_io_slot_t *slots, int more)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        unsigned k = (unsigned)cqe->user_data;
+        tre_io_slot_t *s = &slots[k];
+        if (cqe->res < 0) {
+            s->got = cqe->res;
+        } else {
+            s->got += cqe->res;
+            if (more && cqe->res > 0 && s->got < s->want) {
+                uring_read(r, s->fd, s->buf + s->got, s->want - s->got, s->off + s->got, k);
+                continue;
+            }
+        }
+        s->done = 1;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Hand queued reads to the kernel, optionally waiting for one completion, and reap */
+static int uring_submit(tre_uring_t *r, int wait, tre_io_slot_t *slots)
+{
+    if (r->queued || wait) {
+        long n;
+        do n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait ? 1 : 0,
+                       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        while (n < 0 && errno == EINTR);
+        if (n < 0) return -1;
+        r->queued -= (unsigned)n;
+    }
+    uring_reap(r, slots, 1);
+    return 0;
+}
+
+/* Take back reads still in the SQ (the kernel has not seen them); their slots end cancelled */
+static void uring_withdraw(tre_uring_t *r, tre_io_slot_t *slots)
+{
+    unsigned tail = *r->sq_tail;
+    for (unsigned i = tail - r->queued; i != tail; i++) {
+        tre_io_slot_t *s = &slots[r->sqes[r->sq_array[i & *r->sq_mask]].user_data];
+        s->got = -ECANCELED;
+        s->done = 1;
+    }
+    __atomic_store_n(r->sq_tail, tail - r->queued, __ATOMIC_RELEASE);
+    r->queued = 0;
+}
+
+/* Wait for at least one completion without submitting (or continuing short reads); if the kernel refuses, poll the CQ */
+static void uring_wait(tre_uring_t *r, tre_io_slot_t *slots)
+{
+    long n = syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n < 0 && errno != EINTR) {
+        struct timespec ts = { 0, 100000 };
+        nanosleep(&ts, NULL);
+    }
+    uring_reap(r, slots, 0);
+}
+#endif
+
+/* pread() until want bytes or end of file, at most max_read (if > 0) at a time; bytes read or -1 */
+static int read_full(int fd, char *buf, int want, long long off, int max_read)
+{
+    int got = 0;
+    while (got < want) {
+        int len = (max_read > 0 && want - got > max_read) ? max_read : want - got;
+        ssize_t n = pread(fd, buf + got, (size_t)len, (off_t)(off + got));
+        if (n < 0) return -1;
+        if (n == 0) break;
+        got += (int)n;
+    }
+    return got;
+}
+
+int tre_scan_files(tre_prog_t *prog, tre_files_t *io, const char *const *paths, int npaths,
+                   char delim, int field, tre_line_fn fn, void *user)
+{
+    if (!prog || !io || !io->mem || (!paths && npaths) || npaths < 0 || field < 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    const int nbufs = files_nbufs(io->depth), overlap = io->overlap;
+    char *base = (char *)(((uintptr_t)io->mem + 63) & ~(uintptr_t)63);
+    tre_io_slot_t *slots = (tre_io_slot_t *)base;
+    char *carry = base + TRE_ALIGN64(nbufs * (int)sizeof(tre_io_slot_t));
+    char *bufs = carry + overlap;
+    const int stride = files_stride(io->chunk, overlap);
+
+    io->files = io->errors = io->reads = 0;
+    io->bytes = 0;
+    io->file = -1;
+    io->uring = 0;
+#ifdef TRE_URING
+    tre_uring_t ring;
+    if (!io->sync && uring_open(&ring, (unsigned)nbufs) == 0) {
+        io->uring = 1;
+        ring.max_read = io->max_read;
+    }
+#endif
+
+    // Read cursor: the file whose next chunk gets queued, fd owned until its last chunk is queued
+    int cur = -1, cur_fd = -1, bad = -1;
+    long long cur_off = 0, cur_size = 0;
+    unsigned submitted = 0, processed = 0;
+    int carrylen = 0, matched = 0, stop = 0, failed = 0;
+
+    while (!stop && !failed) {
+        // Keep every free buffer busy with the next chunk
+        while (submitted - processed < (unsigned)nbufs) {
+            while (cur_fd < 0 && cur + 1 < npaths) {
+                struct stat st;
+                cur++;
+                cur_off = 0;
+                cur_fd = open(paths[cur], O_RDONLY | O_CLOEXEC);
+                if (cur_fd >= 0 && fstat(cur_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+                    cur_size = st.st_size;
+                    io->files++;
+                    if (cur_size > 0) break;
+                } else {
+                    io->errors++;
+                }
+                if (cur_fd >= 0) close(cur_fd);
+                cur_fd = -1;
+            }
+            if (cur_fd < 0) break;
+
+            unsigned k = submitted % (unsigned)nbufs;
+            tre_io_slot_t *s = &slots[k];
+            char *data = bufs + (size_t)k * stride + overlap;
+            s->fd = cur_fd;
+            s->file = cur;
+            s->off = cur_off;
+            s->want = (cur_size - cur_off < io->chunk) ? (int)(cur_size - cur_off) : io->chunk;
+            s->last = (cur_off + s->want >= cur_size);
+            s->buf = data;
+            s->got = 0;
+            s->done = 0;
+            cur_off += s->want;
+            if (s->last) cur_fd = -1;            // the slot closes it
+            io->reads++;
+#ifdef TRE_URING
+            if (io->uring) uring_read(&ring, s->fd, data, s->want, s->off, k);
+            else
+#endif
+            {
+                s->got = read_full(s->fd, data, s->want, s->off, io->max_read);
+                s->done = 1;
+            }
+            submitted++;
+        }
+        if (processed == submitted) break;      // nothing left to read
+
+        // Oldest chunk: wait for it, then match it while the others are read
+        unsigned k = processed % (unsigned)nbufs;
+        tre_io_slot_t *s = &slots[k];
+#ifdef TRE_URING
+        if (io->uring && uring_submit(&ring, !s->done, slots) < 0) {
+            failed = 1;                         // cannot even reach the kernel; fall out and drain
+            break;
+        }
+        while (!s->done)
+            if (uring_submit(&ring, 1, slots) < 0) { failed = 1; break; }
+        if (failed) break;
+#endif
+        char *data = bufs + (size_t)k * stride + overlap;
+        int n = s->got;
+        if (s->off == 0) carrylen = 0;          // new file
+        if (n < 0 || s->file == bad) {
+            if (s->file != bad) io->errors++;
+            bad = s->file;
+            n = 0;
+            carrylen = 0;
+        }
+        io->bytes += n;
+
+        char *text = data - carrylen;
+        int len = carrylen + n;
+        memcpy(text, carry, (size_t)carrylen);
+        carrylen = 0;
+        if (!s->last && n == s->want) {
+            // Keep the partial last line for the next chunk, unless it is too long to carry
+            int tail = 0;
+            while (tail < len && text[len - 1 - tail] != '\n') tail++;
+            if (tail <= overlap) {
+                memcpy(carry, text + len - tail, (size_t)tail);
+                carrylen = tail;
+                len -= tail;
+            }
+        }
+
+        io->file = s->file;
+        int r = scan_lines(prog, text, len, delim, field, fn, user, &stop);
+        if (s->last) close(s->fd);
+        processed++;
+        if (r < 0) failed = 2;
+        else matched += r;
+    }
+
+    // Stopped early: the kernel may still be writing into the pool, so wait for every read
+#ifdef TRE_URING
+    if (io->uring) {
+        // Reads it never took are withdrawn; the rest must complete, even if submitting failed
+        uring_withdraw(&ring, slots);
+        for (unsigned i = processed; i != submitted; i++)
+            while (!slots[i % (unsigned)nbufs].done) uring_wait(&ring, slots);
+    }
+#endif
+    for (; processed != submitted; processed++) {
+        tre_io_slot_t *s = &slots[processed % (unsigned)nbufs];
+        if (s->last) close(s->fd);
+    }
+    if (cur_fd >= 0) close(cur_fd);
+#ifdef TRE_URING
+    if (io->uring) uring_close(&ring);
+#endif
+
+    if (failed == 2) return -1;                 // tre_last_error says which limit
+    if (failed) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    tre_last_error = TRE_OK;
+    return matched;
+}
+
+// ─────────────────────────────────────────────────────
+// Match-count estimation: scan a random sample of
+// fixed-size blocks and scale up (cluster sampling)
+//
+// A line belongs to the block holding its first byte,
+// so every line is counted in exactly one block and
+// scanning all blocks gives the exact count.
+// ─────────────────────────────────────────────────────
+
+#define TRE_EST_BLOCK      (64 * 1024)
+#define TRE_EST_Z          1.96            // 95% two-sided
+#define TRE_EST_MIN_BLOCKS 32
+
+/* Square root by Newton's method, keeps the library free of libm */
+static double est_sqrt(double x)
+{
+    if (x <= 0) return 0;
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 64; i++) {
+        double next = 0.5 * (r + x / r);
+        if (next >= r) break;
+        r = next;
+    }
+    return r;
+}
+
+/* Keyed bijection on [0, 2^bits): visits the blocks in a scattered order without a table */
+static uint64_t est_mix(uint64_t x, int bits, uint64_t seed)
+{
+    const uint64_t mask = (bits >= 64) ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+    const int shift = bits / 2 + 1;
+    for (int r = 0; r < 4; r++) {
+        seed += 0x9e3779b97f4a7c15ULL;                    // splitmix64 round keys
+        uint64_t k = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        k ^= k >> 27;
+        x = ((x ^ k) * (k | 1)) & mask;
+        x ^= x >> shift;
+    }
+    return x;
+}
+
+/* Matching lines among those starting in block b, -1 if cut off by a limit */
+static int est_block(tre_prog_t *prog, const char *buf, long long buflen, long long b, int block,
+                     char delim, int field)
+{
+    const char *end = buf + buflen;
+    const char *lo = buf + b * block;
+    const char *hi = (buflen - b * block > block) ? lo + block : end;
+
+    if (lo > buf && lo[-1] != '\n') {                     // skip the tail of the previous block's line
+        const char *nl = memchr(lo, '\n', (size_t)(hi - lo));
+        if (!nl) return 0;
+        lo = nl + 1;
+    }
+    if (lo >= hi) return 0;
+    const char *stop = memchr(hi - 1, '\n', (size_t)(end - (hi - 1)));   // finish the last line started here
+    stop = stop ? stop + 1 : end;
+    if (stop - lo > 0x7fffffff) stop = lo + 0x7fffffff;
+
+    int halt = 0;
+    return scan_lines(prog, lo, (int)(stop - lo), delim, field, NULL, NULL, &halt);
+}
+
+void tre_estimate_init(tre_estimate_t *est, double target, uint64_t seed)
+{
+    memset(est, 0, sizeof(*est));
+    est->block = TRE_EST_BLOCK;
+    est->z = TRE_EST_Z;
+    est->target = target;
+    est->min_blocks = TRE_EST_MIN_BLOCKS;
+    est->seed = seed;
+}
+
+int tre_estimate_lines(tre_prog_t *prog, const char *buf, long long buflen, char delim, int field,
+                       tre_estimate_t *est)
+{
+    if (!prog || !buf || buflen < 0 || field < 0 || !est || est->block <= 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    const long long nblocks = (buflen + est->block - 1) / est->block;
+    if (nblocks == 0) {                         // empty input: exactly nothing matches
+        est->blocks = est->sampled = est->hits = 0;
+        est->estimate = est->low = est->high = 0;
+        est->exact = 1;
+        tre_last_error = TRE_OK;
+        return 0;
+    }
+    long long budget = (est->max_blocks > 0 && est->max_blocks < nblocks) ? est->max_blocks : nblocks;
+    long long round = est->min_blocks > 0 ? est->min_blocks : TRE_EST_MIN_BLOCKS;
+    int bits = 0;
+    while (((long long)1 << bits) < nblocks) bits++;
+    const uint64_t span = (uint64_t)1 << bits;
+
+    double sum = 0, sumsq = 0;
+    long long n = 0;
+    uint64_t i = 0;
+    est->blocks = nblocks;
+
+    for (;;) {
+        // Next round: doubles the sample until the interval is tight enough or the budget is spent
+        long long want = n + round < budget ? n + round : budget;
+        for (; n < want && i < span; i++) {
+            uint64_t b = est_mix(i, bits, est->seed);
+            if ((long long)b >= nblocks) continue;
+            int hits = est_block(prog, buf, buflen, (long long)b, est->block, delim, field);
+            if (hits < 0) return -1;            // tre_last_error says which limit
+            sum += hits;
+            sumsq += (double)hits * hits;
+            n++;
+        }
+        round = n;
+
+        double mean = n ? sum / n : 0;
+        double var = n > 1 ? (sumsq - n * mean * mean) / (n - 1) : 0;
+        if (var < 0) var = 0;
+        double fpc = 1.0 - (double)n / (double)nblocks;   // finite population correction
+        double half = est->z * (double)nblocks * est_sqrt(fpc * var / (n ? n : 1));
+        if (sum == 0 && n < nblocks)
+            half = 3.0 * (double)nblocks / n;           // nothing seen: rule of three
+        est->sampled = n;
+        est->hits = (long long)sum;
+        est->estimate = mean * (double)nblocks;
+        est->low = est->estimate - half > sum ? est->estimate - half : sum;
+        est->high = est->estimate + half;
+        est->exact = (n == nblocks);
+
+        if (est->exact || n >= budget) break;
+        if (est->target > 0 && sum > 0 && half <= est->target * est->estimate) break;
+        if (est->target <= 0) break;            // one round only
+    }
+    tre_last_error = TRE_OK;
+    return 0;
+}
+
+// ─────────────────────────────────────────────────────
+// Byte-presence signatures: reject patterns whose
+// required bytes are missing from the text
+// ─────────────────────────────────────────────────────
+void tre_sig_init(tre_sig_t *sig, const char *text, int textlen)
+{
+    // Four independent bitmaps keep the read-modify-writes from queueing up on each other
+    uint64_t b[4][4];
+    const unsigned char *t = (const unsigned char *)text;
+    int i = 0;
+
+    memset(b, 0, sizeof(b));
+    for (; i + 4 <= textlen; i += 4) {
+        b[0][t[i]     >> 6] |= (uint64_t)1 << (t[i]     & 63);
+        b[1][t[i + 1] >> 6] |= (uint64_t)1 << (t[i + 1] & 63);
+        b[2][t[i + 2] >> 6] |= (uint64_t)1 << (t[i + 2] & 63);
+        b[3][t[i + 3] >> 6] |= (uint64_t)1 << (t[i + 3] & 63);
+    }
+    for (; i < textlen; i++) b[0][t[i] >> 6] |= (uint64_t)1 << (t[i] & 63);
+    for (int w = 0; w < 4; w++) sig->bits[w] = b[0][w] | b[1][w] | b[2][w] | b[3][w];
+}
+
+int tre_sig_reject(const tre_prog_t *prog, const tre_sig_t *sig)
+{
+    const uint64_t *s = sig->bits;
+    if (((prog->need[0] & ~s[0]) | (prog->need[1] & ~s[1]) |
+         (prog->need[2] & ~s[2]) | (prog->need[3] & ~s[3])) != 0) return 1;
+    for (int k = 0; k < prog->nany; k++) {
+        const uint64_t *a = prog->any[k];
+        if (((a[0] & s[0]) | (a[1] & s[1]) | (a[2] & s[2]) | (a[3] & s[3])) == 0) return 1;
+    }
+    return 0;
+}
+
+// ─────────────────────────────────────────────────────
+// Case-folded text view: lowercase a text once, then
+// run every TRE_IGNCASE program on it case-sensitively
+//
+// Compiled igncase literals are already lowercase and
+// classes accept both cases, so on folded text the
+// backtracker can skip tolower() per compared byte.
+// ─────────────────────────────────────────────────────
+
+static void fold_scalar(char *dst, const char *src, int len)
+{
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)src[i];
+        dst[i] = (char)((unsigned)(c - 'A') < 26u ? c | 0x20 : c);
+    }
+}
+
+#ifdef TRE_X86
+__attribute__((target("sse2")))
+static void fold_sse2(char *dst, const char *src, int len)
+{
+    const __m128i lo = _mm_set1_epi8('A' - 1), hi = _mm_set1_epi8('Z' + 1), bit = _mm_set1_epi8(0x20);
+    int i = 0;
+    for (; len - i >= 16; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i up = _mm_and_si128(_mm_cmpgt_epi8(x, lo), _mm_cmplt_epi8(x, hi));   // bytes >= 0x80 are negative
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(x, _mm_and_si128(up, bit)));
+    }
+    fold_scalar(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void fold_avx2(char *dst, const char *src, int len)
+{
+    const __m256i lo = _mm256_set1_epi8('A' - 1), hi = _mm256_set1_epi8('Z' + 1), bit = _mm256_set1_epi8(0x20);
+    int i = 0;
+    for (; len - i >= 32; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i up = _mm256_and_si256(_mm256_cmpgt_epi8(x, lo), _mm256_cmpgt_epi8(hi, x));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(x, _mm256_and_si256(up, bit)));
+    }
+    fold_sse2(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void fold_avx512(char *dst, const char *src, int len)
+{
+    const __m512i a = _mm512_set1_epi8('A'), n = _mm512_set1_epi8(26), bit = _mm512_set1_epi8(0x20);
+    int i = 0;
+    for (; len - i >= 64; i += 64) {
+        __m512i x = _mm512_loadu_si512((const void *)(src + i));
+        __mmask64 up = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(x, a), n);
+        _mm512_storeu_si512((void *)(dst + i), _mm512_mask_add_epi8(x, up, x, bit));
+    }
+    fold_avx2(dst + i, src + i, len - i);
+}
+#endif
+
+void tre_fold_init(tre_fold_t *view, const char *text, int len, char *buf)
+{
+    view->text = text;
+    view->folded = buf;
+    view->len = len;
+    switch (tre_simd_level()) {
+#ifdef TRE_X86
+        case TRE_SIMD_AVX512: fold_avx512(buf, text, len); break;
+        case TRE_SIMD_AVX2:   fold_avx2(buf, text, len);   break;
+        case TRE_SIMD_SSE2:   fold_sse2(buf, text, len);   break;
+#endif
+        default:              fold_scalar(buf, text, len); break;
+    }
+    buf[len] = '\0';
+}
+
+char* tre_exec_folded(tre_prog_t *prog, const tre_fold_t *view, int *length, int direction)
+{
+    if (!prog || !(prog->flags & TRE_IGNCASE)) return tre_execn(prog, view->text, view->len, length, direction);
+
+    tre_text_folded = 1;
+    char *res = tre_execn(prog, view->folded, view->len, length, direction);
+    tre_text_folded = 0;
+    return res ? (char *)view->text + (res - view->folded) : NULL;
+}
+
+// ─────────────────────────────────────────────────────
+// Dictionary-encoded columns: one search per distinct
+// value, then codes -> selection bits by table lookup
+// ─────────────────────────────────────────────────────
+
+/* Selection bits for codes [from, ncodes); returns rows selected or -1 on a bad code */
+static int dict_select_scalar(const int *hits, int ndict, const int *codes, int from, int ncodes,
+                              unsigned char *selection)
+{
+    int count = 0;
+    for (int i = from; i < ncodes; i++) {
+        if ((unsigned)codes[i] >= (unsigned)ndict) return -1;
+        if (hits[codes[i]]) {
+            selection[i >> 3] |= (unsigned char)(1 << (i & 7));
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef TRE_X86
+__attribute__((target("avx2")))
+static int dict_select_avx2(const int *hits, int ndict, const int *codes, int ncodes, unsigned char *selection)
+{
+    const __m256i last = _mm256_set1_epi32(ndict - 1), zero = _mm256_setzero_si256();
+    int count = 0, i = 0;
+    for (; i + 8 <= ncodes; i += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(codes + i));
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi32(idx, last), _mm256_cmpgt_epi32(zero, idx));
+        if (!_mm256_testz_si256(bad, bad)) return -1;
+        __m256i sel = _mm256_i32gather_epi32(hits, idx, 4);
+        unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(sel));
+        selection[i >> 3] = (unsigned char)bits;
+        count += __builtin_popcount(bits);
+    }
+    int rest = dict_select_scalar(hits, ndict, codes, i, ncodes, selection);
+    return rest < 0 ? -1 : count + rest;
+}
+
+__attribute__((target("avx512f")))
+static int dict_select_avx512(const int *hits, int ndict, const int *codes, int ncodes, unsigned char *selection)
+{
+    const __m512i last = _mm512_set1_epi32(ndict - 1);
+    int count = 0, i = 0;
+    for (; i + 16 <= ncodes; i += 16) {
+        __m512i idx = _mm512_loadu_si512((const void *)(codes + i));
+        if (_mm512_cmpgt_epu32_mask(idx, last)) return -1;     // negative codes are huge unsigned
+        __m512i sel = _mm512_i32gather_epi32(idx, hits, 4);
+        unsigned bits = (unsigned)_mm512_test_epi32_mask(sel, sel);
+        selection[i >> 3]       = (unsigned char)bits;
+        selection[(i >> 3) + 1] = (unsigned char)(bits >> 8);
+        count += __builtin_popcount(bits);
+    }
+    int rest = dict_select_scalar(hits, ndict, codes, i, ncodes, selection);
+    return rest < 0 ? -1 : count + rest;
+}
+#endif
+
+int tre_match_dict(tre_prog_t *prog, const char *const *dict, const int *lens, int ndict,
+                   const int *codes, int ncodes, int *hits, unsigned char *selection)
+{
+    tre_last_error = TRE_OK;
+    if (!prog || !dict || ndict <= 0 || !codes || ncodes < 0 || !hits || !selection) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+
+    // One search per dictionary entry; -1 (all bits set) marks a match for the gathers
+    for (int d = 0; d < ndict; d++) {
+        int len = lens ? lens[d] : (int)strlen(dict[d]);
+        hits[d] = tre_execn(prog, dict[d], len, NULL, 1) ? -1 : 0;
+        if (tre_last_error != TRE_OK && tre_last_error != TRE_ERROR_NO_MATCH) return -1;
+    }
+    tre_last_error = TRE_OK;
+
+    memset(selection, 0, (size_t)(ncodes + 7) / 8);
+    int count;
+    switch (tre_simd_level()) {
+#ifdef TRE_X86
+        case TRE_SIMD_AVX512: count = dict_select_avx512(hits, ndict, codes, ncodes, selection); break;
+        case TRE_SIMD_AVX2:   count = dict_select_avx2(hits, ndict, codes, ncodes, selection); break;
+#endif
+        default:              count = dict_select_scalar(hits, ndict, codes, 0, ncodes, selection); break;
+    }
+    if (count < 0) tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+    return count;
+}
+
+// ─────────────────────────────────────────────────────
+// Short strings in batches: up to 64 strings of at most
+// 16 bytes are transposed into columns (byte j of every
+// string side by side), so one vector compare tests one
+// position of 16/32/64 strings. Length, start byte and
+// required bytes are checked across all lanes at once;
+// only the surviving strings are searched.
+// ─────────────────────────────────────────────────────
+#define TRE_BATCH_LANES  64
+#define TRE_BATCH_WIDTH  16      // longest string the column filter takes
+#define TRE_BATCH_NEED    8      // required bytes tested per lane
+
+typedef struct {
+    int minlen;
+    int anchored;                        // start byte only at position 0
+    const tre_scan_t *start;             // bytes a match starts with, NULL = no test
+    int nneed;
+    unsigned char need[TRE_BATCH_NEED];
+} tre_batch_filter_t;
+
+typedef struct {
+    unsigned char col[TRE_BATCH_WIDTH][TRE_BATCH_LANES] __attribute__((aligned(64)));
+    unsigned char len[TRE_BATCH_LANES] __attribute__((aligned(64)));
+} tre_batch_t;
+
+/* Lanes (bit i = lane i) that may match; bytes past a lane's length are ignored */
+static uint64_t batch_filter_scalar(const tre_batch_filter_t *f, const tre_batch_t *b, int lanes)
+{
+    uint64_t live = 0;
+    for (int i = 0; i < lanes; i++) {
+        int len = b->len[i], ok = len >= f->minlen;
+        if (ok && f->start) {
+            int last = f->anchored ? 0 : len - f->minlen;
+            ok = 0;
+            for (int j = 0; j <= last && !ok; j++) ok = TRE_INTABLE(f->start->set, b->col[j][i]);
+        }
+        for (int k = 0; ok && k < f->nneed; k++) {
+            ok = 0;
+            for (int j = 0; j < len && !ok; j++) ok = (b->col[j][i] == f->need[k]);
+        }
+        if (ok) live |= (uint64_t)1 << i;
+    }
+    return live;
+}
+
+#ifdef TRE_X86
+__attribute__((target("sse2")))
+static uint64_t batch_filter_sse2(const tre_batch_filter_t *f, const tre_batch_t *b, int lanes)
+{
+    uint64_t live = 0;
+    int starts = (f->start && f->start->kind == TRE_SCAN_BYTES);   // larger sets need pshufb
+    for (int g = 0; g < lanes; g += 16) {
+        __m128i len = _mm_load_si128((const __m128i *)(b->len + g));
+        __m128i ok = _mm_cmpgt_epi8(len, _mm_set1_epi8((char)(f->minlen - 1)));
+        if (starts) {
+            __m128i slack = _mm_sub_epi8(len, _mm_set1_epi8((char)f->minlen)), hit = _mm_setzero_si128();
+            for (int j = 0; j < (f->anchored ? 1 : TRE_BATCH_WIDTH); j++) {
+                __m128i v = _mm_load_si128((const __m128i *)(b->col[j] + g)), eq = _mm_setzero_si128();
+                for (int k = 0; k < f->start->nbytes; k++)
+                    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)f->start->bytes[k])));
+                hit = _mm_or_si128(hit, _mm_and_si128(eq, _mm_cmpgt_epi8(slack, _mm_set1_epi8((char)(j - 1)))));
+            }
+            ok = _mm_and_si128(ok, hit);
+        }
+        for (int k = 0; k < f->nneed; k++) {
+            __m128i c = _mm_set1_epi8((char)f->need[k]), hit = _mm_setzero_si128();
+            for (int j = 0; j < TRE_BATCH_WIDTH; j++)
+                hit = _mm_or_si128(hit, _mm_and_si128(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(b->col[j] + g)), c),
+                                                      _mm_cmpgt_epi8(len, _mm_set1_epi8((char)j))));
+            ok = _mm_and_si128(ok, hit);
+        }
+        live |= (uint64_t)(unsigned)_mm_movemask_epi8(ok) << g;
+    }
+    return live;
+}
+
+__attribute__((target("avx2")))
+static uint64_t batch_filter_avx2(const tre_batch_filter_t *f, const tre_batch_t *b, int lanes)
+{
+    const tre_scan_t *sc = f->start;
+    __m256i lo = _mm256_setzero_si256(), hi = lo, bits = lo;
+    if (sc && sc->kind == TRE_SCAN_SET) {
+        lo   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->lo));
+        hi   = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)sc->hi));
+        bits = _mm256_broadcastsi128_si256(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                         1, 2, 4, 8, 16, 32, 64, -128));
+    }
+    uint64_t live = 0;
+    for (int g = 0; g < lanes; g += 32) {
+        __m256i len = _mm256_load_si256((const __m256i *)(b->len + g));
+        __m256i ok = _mm256_cmpgt_epi8(len, _mm256_set1_epi8((char)(f->minlen - 1)));
+        if (sc) {
+            __m256i slack = _mm256_sub_epi8(len, _mm256_set1_epi8((char)f->minlen)), hit = _mm256_setzero_si256();
+            for (int j = 0; j < (f->anchored ? 1 : TRE_BATCH_WIDTH); j++) {
+                __m256i v = _mm256_load_si256((const __m256i *)(b->col[j] + g)), eq = _mm256_setzero_si256();
+                if (sc->kind == TRE_SCAN_BYTES) {
+                    for (int k = 0; k < sc->nbytes; k++)
+                        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)sc->bytes[k])));
+                } else {
+                    __m256i nib  = _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f));
+                    __m256i rows = _mm256_or_si256(_mm256_shuffle_epi8(lo, v),
+                                                   _mm256_shuffle_epi8(hi, _mm256_xor_si256(v, _mm256_set1_epi8((char)0x80))));
+                    __m256i in   = _mm256_and_si256(rows, _mm256_shuffle_epi8(bits, nib));
+                    eq = _mm256_xor_si256(_mm256_cmpeq_epi8(in, _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+                }
+                hit = _mm256_or_si256(hit, _mm256_and_si256(eq, _mm256_cmpgt_epi8(slack, _mm256_set1_epi8((char)(j - 1)))));
+            }
+            ok = _mm256_and_si256(ok, hit);
+        }
+        for (int k = 0; k < f->nneed; k++) {
+            __m256i c = _mm256_set1_epi8((char)f->need[k]), hit = _mm256_setzero_si256();
+            for (int j = 0; j < TRE_BATCH_WIDTH; j++)
+                hit = _mm256_or_si256(hit, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(b->col[j] + g)), c),
+                                                            _mm256_cmpgt_epi8(len, _mm256_set1_epi8((char)j))));
+            ok = _mm256_and_si256(ok, hit);
+        }
+        live |= (uint64_t)(unsigned)_mm256_movemask_epi8(ok) << g;
+    }
+    return live;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static uint64_t batch_filter_avx512(const tre_batch_filter_t *f, const tre_batch_t *b, int lanes)
+{
+    const tre_scan_t *sc = f->start;
+    __m512i len = _mm512_load_si512((const void *)b->len);
+    __mmask64 ok = _mm512_cmpgt_epi8_mask(len, _mm512_set1_epi8((char)(f->minlen - 1)));
+    if (sc) {
+        __m512i lo   = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)sc->lo));
+        __m512i hi   = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)sc->hi));
+        __m512i bits = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                                            1, 2, 4, 8, 16, 32, 64, -128));
+        __m512i slack = _mm512_sub_epi8(len, _mm512_set1_epi8((char)f->minlen));
+        __mmask64 hit = 0;
+        for (int j = 0; j < (f->anchored ? 1 : TRE_BATCH_WIDTH); j++) {
+            __m512i v = _mm512_load_si512((const void *)b->col[j]);
+            __mmask64 eq = 0;
+            if (sc->kind == TRE_SCAN_BYTES) {
+                for (int k = 0; k < sc->nbytes; k++)
+                    eq |= _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8((char)sc->bytes[k]));
+            } else {
+                __m512i nib  = _mm512_and_si512(_mm512_srli_epi16(v, 4), _mm512_set1_epi8(0x0f));
+                __m512i rows = _mm512_or_si512(_mm512_shuffle_epi8(lo, v),
+                                               _mm512_shuffle_epi8(hi, _mm512_xor_si512(v, _mm512_set1_epi8((char)0x80))));
+                eq = _mm512_test_epi8_mask(rows, _mm512_shuffle_epi8(bits, nib));
+            }
+            hit |= eq & _mm512_cmpgt_epi8_mask(slack, _mm512_set1_epi8((char)(j - 1)));
+        }
+        ok &= hit;
+    }
+    for (int k = 0; ok && k < f->nneed; k++) {
+        __m512i c = _mm512_set1_epi8((char)f->need[k]);
+        __mmask64 hit = 0;
+        for (int j = 0; j < TRE_BATCH_WIDTH; j++)
+            hit |= _mm512_cmpeq_epi8_mask(_mm512_load_si512((const void *)b->col[j]), c)
+                 & _mm512_cmpgt_epi8_mask(len, _mm512_set1_epi8((char)j));
+        ok &= hit;
+    }
+    return lanes < 64 ? ok & (((uint64_t)1 << lanes) - 1) : ok;
+}
+#endif
+
+/* Search one string; 1 and its selection bit set on a match, -1 if cut off by a limit */
+static int batch_search(tre_prog_t *prog, const char *str, int len, int i, unsigned char *selection)
+{
+    if (tre_execn(prog, str, len, NULL, 1)) {
+        selection[i >> 3] |= (unsigned char)(1 << (i & 7));
+        return 1;
+    }
+    return (tre_last_error == TRE_ERROR_NO_MATCH) ? 0 : -1;
+}
+
+int tre_match_batch(tre_prog_t *prog, const char *const *strs, const int *lens, int n, unsigned char *selection)
+{
+    tre_batch_filter_t f;
+    tre_scan_t first;
+    tre_batch_t b;
+    int idx[TRE_BATCH_LANES];
+
+    tre_last_error = TRE_OK;
+    if (!prog || !strs || n < 0 || !selection) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+
+    // What every match needs; anchored programs keep no start scan, so build one for position 0
+    memset(&f, 0, sizeof(f));
+    f.minlen = prog->minlen;
+    f.anchored = prog->anchored;
+    if (prog->anchored && (prog->inst->op == TRE_OP_CHAR || prog->inst->op == TRE_OP_CLASS)) {
+        unsigned char set[32] = { 0 };
+        for (int c = 0; c < 256; c++)
+            if (inst_accepts(prog, prog->inst, c)) set[c >> 3] |= (unsigned char)(1 << (c & 7));
+        scan_init(&first, set);
+        f.start = &first;
+    } else if (!prog->anchored) {
+        f.start = &prog->scan;
+    }
+    if (f.minlen == 0 || (f.start && f.start->kind == TRE_SCAN_NONE)) f.start = NULL;
+    for (int c = 0; c < 256 && f.nneed < TRE_BATCH_NEED; c++)
+        if (prog->need[c >> 6] >> (c & 63) & 1) f.need[f.nneed++] = (unsigned char)c;
+
+    memset(selection, 0, (size_t)(n + 7) / 8);
+    memset(&b, 0, sizeof(b));
+    int level = tre_simd_level(), count = 0;
+    for (int i = 0; i < n; ) {
+        // Fill the lanes with short strings; longer ones are searched right away
+        int lanes = 0;
+        for (; i < n && lanes < TRE_BATCH_LANES; i++) {
+            int len = lens ? lens[i] : (int)strlen(strs[i]);
+            if (len > TRE_BATCH_WIDTH) {
+                int r = batch_search(prog, strs[i], len, i, selection);
+                if (r < 0) return -1;
+                count += r;
+                continue;
+            }
+            for (int j = 0; j < len; j++) b.col[j][lanes] = (unsigned char)strs[i][j];
+            b.len[lanes] = (unsigned char)len;
+            idx[lanes++] = i;
+        }
+        memset(b.len + lanes, 0, (size_t)(TRE_BATCH_LANES - lanes));
+
+        uint64_t live;
+        if (f.minlen > TRE_BATCH_WIDTH) {
+            live = 0;
+        } else switch (level) {
+#ifdef TRE_X86
+            case TRE_SIMD_AVX512: live = batch_filter_avx512(&f, &b, lanes); break;
+            case TRE_SIMD_AVX2:   live = batch_filter_avx2(&f, &b, (lanes + 31) & ~31); break;
+            case TRE_SIMD_SSE2:   live = batch_filter_sse2(&f, &b, (lanes + 15) & ~15); break;
+#endif
+            default:              live = batch_filter_scalar(&f, &b, lanes); break;
+        }
+        if (lanes < TRE_BATCH_LANES) live &= ((uint64_t)1 << lanes) - 1;
+
+        // Only the survivors reach the matcher
+        for (; live; live &= live - 1) {
+            int lane = __builtin_ctzll(live);
+            int r = batch_search(prog, strs[idx[lane]], b.len[lane], idx[lane], selection);
+            if (r < 0) return -1;
+            count += r;
+        }
+    }
+    tre_last_error = TRE_OK;
+    return count;
+}
+
+// ─────────────────────────────────────────────────────
+// match(): compile into a static scratch program (kept
+// for the next call with the same pattern) and run it
+// ─────────────────────────────────────────────────────
+#ifndef TRE_MATCH_SCRATCH_BYTES
+#define TRE_MATCH_SCRATCH_BYTES  (256 + (TRE_DEFAULT_MAX_PATTERN_LENGTH + 1) * (int)(sizeof(tre_inst_t) + 33))
+#endif
+
+static unsigned char tre_match_scratch[TRE_MATCH_SCRATCH_BYTES];
+static unsigned char *tre_match_heap = NULL;     // for programs the scratch cannot hold
+static int tre_match_heap_size = 0;
+static tre_prog_t *tre_match_prog = NULL;
+
+/* match: search for regexp anywhere in text (unless ^) */
+char* match(char *regexp, char *text, int *length, int igncase, int direction)
+{
+    tre_last_error = TRE_OK;
+    if (length) *length = 0;
+
+    if (!regexp || !text) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return NULL;
+    }
+    // Limited like tre_compile(): by program size (tre_max_program_size), not text length
+    int flags = igncase ? TRE_IGNCASE : 0;
+    if (!tre_match_prog || tre_match_prog->flags != flags || strcmp(tre_match_prog->pattern, regexp) != 0) {
+        tre_match_prog = NULL;
+        int size = tre_compile_size(regexp, flags);
+        if (size < 0) return NULL;
+        void *mem = tre_match_scratch;
+        if (size > (int)sizeof(tre_match_scratch)) {
+            if (size > tre_match_heap_size) {
+                unsigned char *grown = realloc(tre_match_heap, (size_t)size);
+                if (!grown) {
+                    tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+                    return NULL;
+                }
+                tre_match_heap = grown;
+                tre_match_heap_size = size;
+            }
+            mem = tre_match_heap;
+        }
+        tre_match_prog = tre_compile(regexp, flags, mem, size);
+        if (!tre_match_prog) return NULL;
+    }
+    return execute(tre_match_prog, text, (int)strlen(text), length, direction);
+}
+
+// ─────────────────────────────────────────────────────
+// Self-tuning limits: learn a per-pattern distribution
+// of steps and depth, then cut off at a percentile
+// ─────────────────────────────────────────────────────
+
+void tre_tune_init(tre_tune_t *tune, int warmup, int percentile, int headroom)
+{
+    memset(tune, 0, sizeof(*tune));
+    tune->warmup     = warmup     >  0 ? warmup     : TRE_DEFAULT_TUNE_WARMUP;
+    tune->percentile = percentile >  0 ? percentile : TRE_DEFAULT_TUNE_PERCENTILE;
+    tune->headroom   = headroom   >= 0 ? headroom   : TRE_DEFAULT_TUNE_HEADROOM;
+    if (tune->percentile > 100) tune->percentile = 100;
+}
+
+/* Bucket b holds values of bit length b: 0 | 1 | 2-3 | 4-7 | ... */
+static int tune_bucket(int v) {
+    int b = 0;
+    while (v > 0 && b < TRE_TUNE_BUCKETS - 1) { v >>= 1; b++; }
+    return b;
+}
+
+/* Upper bound of the percentile bucket plus headroom, clamped to [floor, ceiling] */
+static int tune_limit(const tre_tune_t *tune, const unsigned int *hist, int floor, int ceiling) {
+    // 64-bit math: the top bucket's bound times the headroom does not fit a 32-bit long
+    int64_t need = ((int64_t)tune->calls * tune->percentile + 99) / 100;
+    int64_t seen = 0;
+    int b = 0;
+    for (; b < TRE_TUNE_BUCKETS - 1; b++) {
+        seen += hist[b];
+        if (seen >= need) break;
+    }
+    int64_t upper = (b == 0) ? 0 : ((int64_t)1 << b) - 1;
+    int64_t limit = upper + upper * tune->headroom / 100;
+    if (limit < floor)   limit = floor;
+    if (limit > ceiling) limit = ceiling;    // ceiling is an int limit, so the result fits
+    return (int)limit;
+}
+
+/* Warm-up: add the call that just finished to the histograms */
+static void tune_record(tre_tune_t *tune)
+{
+    tune->steps_hist[tune_bucket(tre_backtrack_steps)]++;
+    tune->depth_hist[tune_bucket(tre_call_depth)]++;
+    if (++tune->calls >= tune->warmup) {
+        tune->max_steps = tune_limit(tune, tune->steps_hist, TRE_TUNE_MIN_STEPS, tre_max_backtrack_steps);
+        tune->max_depth = tune_limit(tune, tune->depth_hist, TRE_TUNE_MIN_DEPTH, tre_max_depth);
+    }
+}
+
+/* Tuned: temporarily tighten the global limits for one call */
+static void tune_apply(tre_tune_t *tune, int *saved_steps, int *saved_depth)
+{
+    *saved_steps = tre_max_backtrack_steps;
+    *saved_depth = tre_max_depth;
+    if (tune->max_steps < tre_max_backtrack_steps) tre_max_backtrack_steps = tune->max_steps;
+    if (tune->max_depth < tre_max_depth)           tre_max_depth = tune->max_depth;
+}
+
+char* tre_match_tuned(tre_tune_t *tune, char *regexp, char *text, int *length, int igncase, int direction)
+{
+    if (tune->max_steps == 0) {
+        // Warm-up: run under the global limits and record this call
+        char *res = match(regexp, text, length, igncase, direction);
+        if (tre_last_error == TRE_ERROR_PATTERN_TOO_LONG || tre_last_error == TRE_ERROR_MALFORMED_PATTERN)
+            return res;
+        tune_record(tune);
+        return res;
+    }
+
+    int saved_steps, saved_depth;
+    tune_apply(tune, &saved_steps, &saved_depth);
+    char *res = match(regexp, text, length, igncase, direction);
+    tre_max_backtrack_steps = saved_steps;
+    tre_max_depth = saved_depth;
+    return res;
+}
+
+// ─────────────────────────────────────────────────────
+// Result cache: set-associative, clock eviction per set
+// ─────────────────────────────────────────────────────
+typedef struct {
+    uint64_t key;                // keyed hash of the text, 0 = empty slot
+    uint64_t check;              // second, independently keyed hash that confirms a hit
+    int textlen;
+    int offset;                  // match offset, -1 = no match
+    int length;
+    unsigned char direction;     // 1 = backward search
+    unsigned char ref;           // used since the clock hand last passed
+} tre_cache_entry_t;
+
+/* 64-bit hash of the text under seed, 8 bytes per multiply */
+static uint64_t keyed_hash(const char *text, int len, uint64_t seed)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = seed ^ (uint64_t)len;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, text + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 29;
+    }
+    if (i < len) {
+        uint64_t w = 0;
+        memcpy(&w, text + i, (size_t)(len - i));
+        h = (h ^ w) * k;
+    }
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    h ^= h >> 32;
+    return h ? h : 1;            // 0 marks empty slots
+}
+
+/* Fixed-seed hash, for sketches that must agree across processes */
+static uint64_t cache_hash(const char *text, int len)
+{
+    return keyed_hash(text, len, 0x9e3779b97f4a7c15ULL);
+}
+
+/* Secret per-cache seeds, so colliding inputs cannot be built offline */
+static void cache_seed(uint64_t seed[2])
+{
+    int got = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        got = read(fd, seed, 2 * sizeof(uint64_t)) == (ssize_t)(2 * sizeof(uint64_t));
+        close(fd);
+    }
+    if (!got) {
+        // No entropy source: at least differ per process, per cache and per call
+        static uint64_t calls;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t x = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ (uint64_t)(uintptr_t)seed ^ ++calls;
+        for (int i = 0; i < 2; i++) {
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            seed[i] = z ^ (z >> 31);
+        }
+    }
+}
+
+int tre_cache_bytes(int entries)
+{
+    int sets = 1;
+    while (sets * TRE_CACHE_WAYS < entries) sets *= 2;
+    return sets * TRE_CACHE_WAYS * (int)sizeof(tre_cache_entry_t);
+}
+
+int tre_cache_init(tre_cache_t *cache, void *mem, int memsize)
+{
+    int sets = 0;
+    while ((sets ? sets * 2 : 1) * TRE_CACHE_WAYS * (int)sizeof(tre_cache_entry_t) <= memsize)
+        sets = sets ? sets * 2 : 1;
+    cache->nsets = sets;
+    cache->slots = mem;
+    cache_seed(cache->seed);
+    tre_cache_clear(cache);
+    return sets * TRE_CACHE_WAYS;
+}
+
+void tre_cache_clear(tre_cache_t *cache)
+{
+    if (cache->slots) memset(cache->slots, 0, (size_t)cache->nsets * TRE_CACHE_WAYS * sizeof(tre_cache_entry_t));
+    cache->hand = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
+}
+
+void tre_prog_cache(tre_prog_t *prog, tre_cache_t *cache)
+{
+    prog->cache = (cache && cache->nsets > 0) ? cache : NULL;
+}
+
+static tre_cache_entry_t *cache_set(tre_cache_t *cache, uint64_t key)
+{
+    return (tre_cache_entry_t *)cache->slots + (size_t)(key & (uint64_t)(cache->nsets - 1)) * TRE_CACHE_WAYS;
+}
+
+static int cache_lookup(tre_cache_t *cache, const char *text, int textlen, int direction,
+                        uint64_t *key, char **res, int *length)
+{
+    *key = keyed_hash(text, textlen, cache->seed[0]);
+    tre_cache_entry_t *set = cache_set(cache, *key);
+    uint64_t check = 0;          // only hashed again when the key matches
+    for (int w = 0; w < TRE_CACHE_WAYS; w++) {
+        tre_cache_entry_t *e = &set[w];
+        if (e->key == *key && e->textlen == textlen && e->direction == (direction == -1)) {
+            if (!check) check = keyed_hash(text, textlen, cache->seed[1]);
+            if (e->check != check) continue;
+            e->ref = 1;
+            cache->hits++;
+            *res = (e->offset < 0) ? NULL : (char *)text + e->offset;
+            *length = e->length;
+            tre_last_error = (e->offset < 0) ? TRE_ERROR_NO_MATCH : TRE_OK;
+            return 1;
+        }
+    }
+    cache->misses++;
+    return 0;
+}
+
+static void cache_store(tre_cache_t *cache, uint64_t key, int textlen, int direction,
+                        const char *text, const char *res, int length)
+{
+    if (tre_last_error != TRE_OK && tre_last_error != TRE_ERROR_NO_MATCH) return;   // cut off: not a result
+
+    // Free way if any, else sweep from the hand, giving referenced entries a second chance
+    tre_cache_entry_t *set = cache_set(cache, key), *victim = NULL;
+    for (int w = 0; w < TRE_CACHE_WAYS && !victim; w++)
+        if (set[w].key == 0) victim = &set[w];
+    while (!victim) {
+        tre_cache_entry_t *e = &set[cache->hand++ % TRE_CACHE_WAYS];
+        if (e->ref) e->ref = 0;
+        else        victim = e;
+    }
+    if (victim->key) cache->evictions++;
+
+    victim->key = key;
+    victim->check = keyed_hash(text, textlen, cache->seed[1]);
+    victim->textlen = textlen;
+    victim->offset = res ? (int)(res - text) : -1;
+    victim->length = length;
+    victim->direction = (unsigned char)(direction == -1);
+    victim->ref = 0;
+}
+
+// ─────────────────────────────────────────────────────
+// Find-all with aggregation: every match span is
+// hashed once, in place, and fed to a Space-Saving
+// top-K sketch and/or a HyperLogLog counter
+// ─────────────────────────────────────────────────────
+
+char* tre_find_next(tre_prog_t *prog, const char *text, int textlen, int *pos, int *length)
+{
+    if (!prog || !text || textlen < 0 || !pos) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return NULL;
+    }
+    if (*pos > textlen || (prog->anchored && *pos > 0)) {   // done; ^ only matches at the start
+        tre_last_error = TRE_ERROR_NO_MATCH;
+        return NULL;
+    }
+
+    // \b and \B still see the byte before the resume point
+    int len = 0;
+    tre_last_error = TRE_OK;
+    tre_text_origin = text;
+    char *m = execute_tuned(prog, text + *pos, textlen - *pos, &len, 1);
+    tre_text_origin = NULL;
+    *pos = m ? (int)(m - text) + (len > 0 ? len : 1) : textlen + 1;   // one further after an empty match
+    if (length) *length = m ? len : 0;
+    return m;
+}
+
+int tre_find_all(tre_prog_t *prog, const char *text, int textlen, tre_span_fn fn, void *user)
+{
+    int pos = 0, len, found = 0;
+    char *m;
+    while ((m = tre_find_next(prog, text, textlen, &pos, &len)) != NULL) {
+        found++;
+        if (fn && fn(m, len, user)) break;
+    }
+    if (tre_last_error != TRE_OK && tre_last_error != TRE_ERROR_NO_MATCH) return -1;   // bad arguments or cut off
+    tre_last_error = TRE_OK;
+    return found;
+}
+
+// Space-Saving: k counters, the smallest is replaced by a new key and inherits its count as error
+
+int tre_topk_bytes(int k)
+{
+    if (k < 1) return -1;
+    int slots = 1;
+    while (slots < 2 * k) slots *= 2;
+    return (int)(k * sizeof(tre_topk_item_t) + 2 * k * sizeof(int) + slots * sizeof(int)) + 16;
+}
+
+int tre_topk_init(tre_topk_t *topk, int k, void *mem, int memsize)
+{
+    memset(topk, 0, sizeof(*topk));
+    int need = tre_topk_bytes(k);
+    if (need < 0 || !mem || memsize < need) return -1;
+    char *base = (char *)(((uintptr_t)mem + 15) & ~(uintptr_t)15);
+    topk->k = k;
+    topk->nslots = 1;
+    while (topk->nslots < 2 * k) topk->nslots *= 2;
+    topk->items = (tre_topk_item_t *)base;
+    topk->heap  = (int *)(topk->items + k);
+    topk->pos   = topk->heap + k;
+    topk->slots = topk->pos + k;
+    for (int i = 0; i < topk->nslots; i++) topk->slots[i] = -1;
+    return 0;
+}
+
+static int topk_find(const tre_topk_t *t, uint64_t key)
+{
+    int mask = t->nslots - 1;
+    for (int s = (int)(key & (uint64_t)mask); t->slots[s] >= 0; s = (s + 1) & mask)
+        if (t->items[t->slots[s]].key == key) return s;
+    return -1;
+}
+
+static void topk_link(tre_topk_t *t, uint64_t key, int id)
+{
+    int mask = t->nslots - 1, s = (int)(key & (uint64_t)mask);
+    while (t->slots[s] >= 0) s = (s + 1) & mask;
+    t->slots[s] = id;
+}
+
+/* Linear-probing delete: shift later entries of the run back into the hole */
+static void topk_unlink(tre_topk_t *t, int s)
+{
+    int mask = t->nslots - 1;
+    for (int j = (s + 1) & mask; t->slots[j] >= 0; j = (j + 1) & mask) {
+        int home = (int)(t->items[t->slots[j]].key & (uint64_t)mask);
+        if (((j - home) & mask) >= ((j - s) & mask)) {     // home is not in (s, j]: may move to s
+            t->slots[s] = t->slots[j];
+            s = j;
+        }
+    }
+    t->slots[s] = -1;
+}
+
+static void topk_swap(tre_topk_t *t, int i, int j)
+{
+    int a = t->heap[i];
+    t->heap[i] = t->heap[j];
+    t->heap[j] = a;
+    t->pos[t->heap[i]] = i;
+    t->pos[t->heap[j]] = j;
+}
+
+/* Restore the min-heap on counts around heap position i */
+static void topk_sift(tre_topk_t *t, int i)
+{
+    while (i > 0 && t->items[t->heap[i]].count < t->items[t->heap[(i - 1) / 2]].count) {
+        topk_swap(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int c = 2 * i + 1, m = i;
+        if (c < t->n && t->items[t->heap[c]].count < t->items[t->heap[m]].count) m = c;
+        if (c + 1 < t->n && t->items[t->heap[c + 1]].count < t->items[t->heap[m]].count) m = c + 1;
+        if (m == i) return;
+        topk_swap(t, i, m);
+        i = m;
+    }
+}
+
+/* Weighted update: count w occurrences of key, error err already carried by them */
+static void topk_add_hashed(tre_topk_t *t, uint64_t key, const char *str, int len, long long w, long long err)
+{
+    int s = topk_find(t, key);
+    if (s >= 0) {
+        tre_topk_item_t *it = &t->items[t->slots[s]];
+        it->count += w;
+        it->error += err;
+        topk_sift(t, t->pos[t->slots[s]]);
+        return;
+    }
+    int id;
+    long long floor = 0;
+    if (t->n < t->k) {                          // free counter
+        id = t->n;
+        t->heap[t->n] = id;
+        t->pos[id] = t->n++;
+    } else {                                    // take over the smallest
+        id = t->heap[0];
+        floor = t->items[id].count;
+        topk_unlink(t, topk_find(t, t->items[id].key));
+    }
+    tre_topk_item_t *it = &t->items[id];
+    it->key = key;
+    it->str = str;
+    it->len = len;
+    it->count = floor + w;
+    it->error = floor + err;
+    topk_link(t, key, id);
+    topk_sift(t, t->pos[id]);
+}
+
+void tre_topk_add(tre_topk_t *topk, const char *str, int len)
+{
+    topk_add_hashed(topk, cache_hash(str, len), str, len, 1, 0);
+}
+
+/*
+ * Mergeable Space-Saving (Agarwal et al.): a key one full sketch does not track
+ * may have occurred up to that sketch's smallest count, so it is charged that
+ * much on that side; then the k largest combined counters are kept.
+ */
+void tre_topk_merge(tre_topk_t *dst, const tre_topk_t *src)
+{
+    long long dmin = (dst->n == dst->k && dst->n) ? dst->items[dst->heap[0]].count : 0;
+    long long smin = (src->n == src->k && src->n) ? src->items[src->heap[0]].count : 0;
+
+    // dst side: keys src does not track, or both counts at once
+    for (int i = 0; i < dst->n; i++) {
+        tre_topk_item_t *it = &dst->items[i];
+        int s = topk_find(src, it->key);
+        if (s >= 0) {
+            it->count += src->items[src->slots[s]].count;
+            it->error += src->items[src->slots[s]].error;
+        } else {
+            it->count += smin;
+            it->error += smin;
+        }
+    }
+    for (int i = dst->n / 2; i >= 0; i--) topk_sift(dst, i);
+
+    // src side: keys dst did not track compete for the k counters
+    for (int i = 0; i < src->n; i++) {
+        const tre_topk_item_t *in = &src->items[i];
+        if (topk_find(dst, in->key) >= 0) continue;           // already combined above
+        long long count = in->count + dmin, error = in->error + dmin;
+        int id;
+        if (dst->n < dst->k) {
+            id = dst->n;
+            dst->heap[dst->n] = id;
+            dst->pos[id] = dst->n++;
+        } else if (count > dst->items[dst->heap[0]].count) {
+            id = dst->heap[0];                                 // dropped, not inherited
+            topk_unlink(dst, topk_find(dst, dst->items[id].key));
+        } else {
+            continue;
+        }
+        tre_topk_item_t *it = &dst->items[id];
+        it->key = in->key;
+        it->str = in->str;
+        it->len = in->len;
+        it->count = count;
+        it->error = error;
+        topk_link(dst, in->key, id);
+        topk_sift(dst, dst->pos[id]);
+    }
+}
+
+static int topk_cmp(const void *a, const void *b)
+{
+    const tre_topk_item_t *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+int tre_topk_sorted(const tre_topk_t *topk, tre_topk_item_t *out)
+{
+    memcpy(out, topk->items, (size_t)topk->n * sizeof(*out));
+    qsort(out, (size_t)topk->n, sizeof(*out), topk_cmp);
+    return topk->n;
+}
+
+// HyperLogLog: register = longest run of leading zeros seen among the hashes routed to it
+
+void tre_hll_init(tre_hll_t *hll)
+{
+    memset(hll, 0, sizeof(*hll));
+}
+
+static void hll_add_hashed(tre_hll_t *hll, uint64_t h)
+{
+    uint64_t rest = h << TRE_HLL_BITS;
+    int rank = rest ? __builtin_clzll(rest) + 1 : 64 - TRE_HLL_BITS + 1;
+    unsigned char *r = &hll->reg[h >> (64 - TRE_HLL_BITS)];
+    if (rank > *r) *r = (unsigned char)rank;
+}
+
+void tre_hll_add(tre_hll_t *hll, const char *str, int len)
+{
+    hll_add_hashed(hll, cache_hash(str, len));
+}
+
+void tre_hll_merge(tre_hll_t *dst, const tre_hll_t *src)
+{
+    for (int i = 0; i < (1 << TRE_HLL_BITS); i++)
+        if (src->reg[i] > dst->reg[i]) dst->reg[i] = src->reg[i];
+}
+
+/* Natural log for x >= 1 (linear counting), keeps the library free of libm */
+static double hll_ln(double x)
+{
+    double k = 0;
+    while (x >= 2) { x *= 0.5; k += 1; }
+    double y = (x - 1) / (x + 1), y2 = y * y, term = y, sum = 0;
+    for (int i = 1; i < 40; i += 2) {
+        sum += term / i;
+        term *= y2;
+    }
+    return k * 0.6931471805599453 + 2 * sum;
+}
+
+double tre_hll_count(const tre_hll_t *hll)
+{
+    const double m = 1 << TRE_HLL_BITS;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < (1 << TRE_HLL_BITS); i++) {
+        sum += 1.0 / (double)((uint64_t)1 << hll->reg[i]);
+        zeros += (hll->reg[i] == 0);
+    }
+    double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    if (e <= 2.5 * m && zeros) e = m * hll_ln(m / zeros);   // small range: linear counting
+    return e;
+}
+
+typedef struct {
+    tre_topk_t *topk;
+    tre_hll_t  *hll;
+} tre_agg_t;
+
+static int aggregate_span(const char *m, int len, void *user)
+{
+    tre_agg_t *agg = user;
+    uint64_t h = cache_hash(m, len);
+    if (agg->topk) topk_add_hashed(agg->topk, h, m, len, 1, 0);
+    if (agg->hll)  hll_add_hashed(agg->hll, h);
+    return 0;
+}
+
+int tre_aggregate(tre_prog_t *prog, const char *text, int textlen, tre_topk_t *topk, tre_hll_t *hll)
+{
+    tre_agg_t agg = { topk, hll };
+    return tre_find_all(prog, text, textlen, aggregate_span, &agg);
+}
+
+// ─────────────────────────────────────────────────────
+// Shadow execution: sampled calls also run on the
+// backtracker, results and timings are compared
+// ─────────────────────────────────────────────────────
+void tre_shadow_init(tre_shadow_t *shadow, int sample_every)
+{
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->sample_every = sample_every;
+}
+
+void tre_prog_shadow(tre_prog_t *prog, tre_shadow_t *shadow)
+{
+    prog->shadow = shadow;
+}
+
+static unsigned long long shadow_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static char* execute_shadow(tre_prog_t *prog, const char *text, int textlen, int *length, int direction)
+{
+    tre_shadow_t *sh = prog->shadow;
+    sh->calls++;
+    if (!prog->dfa || sh->sample_every <= 0 || sh->calls % (unsigned long)sh->sample_every != 0)
+        return execute_tuned(prog, text, textlen, length, direction);
+    sh->sampled++;
+
+    // Legacy engine first (global limits, no tuning), so the globals end up describing the real call
+    tre_dfa_t *dfa = prog->dfa;
+    int legacy_len = 0;
+    unsigned long long t0 = shadow_now();
+    prog->dfa = NULL;
+    const char *legacy = execute(prog, text, textlen, &legacy_len, direction);
+    prog->dfa = dfa;
+    int legacy_err = tre_last_error;
+    unsigned long long t1 = shadow_now();
+    tre_last_error = TRE_OK;
+    char *res = execute_tuned(prog, text, textlen, length, direction);
+    unsigned long long t2 = shadow_now();
+    sh->legacy_ns += t1 - t0;
+    sh->new_ns += t2 - t1;
+
+    if (legacy_err != TRE_OK && legacy_err != TRE_ERROR_NO_MATCH) {
+        sh->legacy_cutoff++;
+        return res;
+    }
+    if (legacy == res && (!res || legacy_len == *length)) return res;
+
+    tre_shadow_diff_t *d = &sh->log[sh->divergences++ % TRE_SHADOW_LOG];
+    int keep = textlen < TRE_SHADOW_TEXT ? textlen : TRE_SHADOW_TEXT;
+    d->pattern = prog->pattern;
+    memcpy(d->text, text, (size_t)keep);
+    d->text[keep] = '\0';
+    d->textlen = textlen;
+    d->direction = direction;
+    d->legacy_offset = legacy ? (int)(legacy - text) : -1;
+    d->legacy_length = legacy ? legacy_len : 0;
+    d->new_offset = res ? (int)(res - text) : -1;
+    d->new_length = res ? *length : 0;
+    return res;
+}
+
+void tre_shadow_dump(const tre_shadow_t *shadow, FILE *out)
+{
+    unsigned long compared = shadow->sampled - shadow->legacy_cutoff;
+    fprintf(out, "shadow: %lu calls, %lu sampled, %lu compared, %lu diverged, %lu legacy cut off\n",
+            shadow->calls, shadow->sampled, compared, shadow->divergences, shadow->legacy_cutoff);
+    if (shadow->sampled)
+        fprintf(out, "  latency per sampled call: legacy %.0f ns, new %.0f ns (%.2fx)\n",
+                (double)shadow->legacy_ns / (double)shadow->sampled,
+                (double)shadow->new_ns / (double)shadow->sampled,
+                shadow->new_ns ? (double)shadow->legacy_ns / (double)shadow->new_ns : 0.0);
+
+    unsigned long n = shadow->divergences < TRE_SHADOW_LOG ? shadow->divergences : TRE_SHADOW_LOG;
+    for (unsigned long i = 0; i < n; i++) {
+        const tre_shadow_diff_t *d = &shadow->log[(shadow->divergences - n + i) % TRE_SHADOW_LOG];
+        fprintf(out, "  %s on \"%s\"%s (dir %d): legacy %d+%d, new %d+%d\n",
+                d->pattern, d->text, d->textlen > TRE_SHADOW_TEXT ? "..." : "", d->direction,
+                d->legacy_offset, d->legacy_length, d->new_offset, d->new_length);
+    }
+}
+
+// ─────────────────────────────────────────────────────
+// Literal sets: multi-pattern Rabin-Karp. Keywords are
+// grouped by length; each group hashes a window of the
+// same width (the length itself up to 4, then 4, 8, 16
+// or 32 bytes), rolled along the text one byte at a time.
+// A bit filter rejects most windows, the hash table
+// finds the keywords with that window, memcmp confirms.
+//
+//   [keyword bytes][offsets][chains][slots][filter]
+// ─────────────────────────────────────────────────────
+#define TRE_LITS_BASE    0x01000193u      // rolling hash multiplier (odd)
+#define TRE_LITS_BLOCK   64               // text positions filtered before candidates are confirmed
+
+static int pow2_at_least(int n)
+{
+    int p = 1;
+    while (p < n) p *= 2;
+    return p;
+}
+
+/* Hash window width for a keyword of len bytes, and its group */
+static int lits_window(int len) { return len <= 4 ? len : len < 8 ? 4 : len < 16 ? 8 : len < 32 ? 16 : 32; }
+static int lits_bucket(int w)   { return w <= 4 ? w - 1 : w == 8 ? 4 : w == 16 ? 5 : 6; }
+
+/* Table key: the window hash, made distinct per width */
+static uint32_t lits_key(uint32_t h, int w) { return h + (uint32_t)w * 0x9e3779b9u; }
+
+/* Spread a key over 64 bits: filter word (top bits), filter bits (20..31), table slot (from bit 32) */
+static uint64_t lits_mix(uint32_t k) { return (uint64_t)(k ^ (k >> 15)) * 0x9e3779b97f4a7c15ULL; }
+
+static uint64_t lits_bits(uint64_t m) { return (uint64_t)1 << (m >> 20 & 63) | (uint64_t)1 << (m >> 26 & 63); }
+
+static uint32_t lits_hash(const unsigned char *p, int w)
+{
+    uint32_t h = 0;
+    for (int i = 0; i < w; i++) h = h * TRE_LITS_BASE + p[i];
+    return h;
+}
+
+/* Filter words: 16 bits per keyword, at least two */
+static int lits_words(int n) { return pow2_at_least(n / 4 + 2); }
+
+static int lits_size(int n, long long nbytes)
+{
+    long long size = 15 + TRE_ALIGN(nbytes) + TRE_ALIGN((n + 1) * 4) + (long long)TRE_ALIGN(n * 4)
+                   + (long long)pow2_at_least(2 * n) * 8 + lits_words(n) * 8;
+    return size > 0x7fffffff ? -1 : (int)size;
+}
+
+int tre_lits_bytes(const char *const *keywords, const int *lens, int n)
+{
+    long long nbytes = 0;
+    if (!keywords || n <= 0) return -1;
+    for (int i = 0; i < n; i++) {
+        int len = !keywords[i] ? 0 : lens ? lens[i] : (int)strlen(keywords[i]);
+        if (len <= 0) return -1;
+        nbytes += len;
+    }
+    return lits_size(n, nbytes);
+}
+
+int tre_lits_init(tre_lits_t *lits, const char *const *keywords, const int *lens, int n, void *mem, int memsize)
+{
+    int size = tre_lits_bytes(keywords, lens, n);
+    tre_last_error = TRE_OK;
+    if (size < 0 || !mem) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    if (memsize < size) {
+        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+        return -1;
+    }
+
+    // Carve the block; offsets first, they give the byte total
+    memset(lits, 0, sizeof(*lits));
+    unsigned char *p = (unsigned char *)mem + ((16 - ((size_t)mem & 15)) & 15);
+    long long nbytes = 0;
+    for (int i = 0; i < n; i++) nbytes += lens ? lens[i] : (int)strlen(keywords[i]);
+    lits->n = n;
+    lits->bytes = (char *)p;                  p += TRE_ALIGN(nbytes);
+    lits->off   = (int *)p;                   p += TRE_ALIGN((n + 1) * 4);
+    lits->next  = (int *)p;                   p += TRE_ALIGN(n * 4);
+    lits->slots = (uint64_t *)p;              p += pow2_at_least(2 * n) * 8;
+    lits->filter = (uint64_t *)p;             p += lits_words(n) * 8;
+    lits->mask  = pow2_at_least(2 * n) - 1;
+    lits->fmask = lits_words(n) - 1;
+    lits->fshift = 64 - __builtin_ctz((unsigned)lits->fmask + 1);
+    lits->used  = (int)(p - (unsigned char *)mem);
+    memset(lits->slots, 0, (size_t)(lits->mask + 1) * 8);
+    memset(lits->filter, 0, (size_t)(lits->fmask + 1) * 8);
+
+    int used[TRE_LITS_BUCKETS] = { 0 };
+    for (int i = 0, at = 0; i < n; i++) {
+        int len = lens ? lens[i] : (int)strlen(keywords[i]);
+        memcpy(lits->bytes + at, keywords[i], (size_t)len);
+        lits->off[i] = at;
+        at += len;
+        lits->off[i + 1] = at;
+    }
+
+    // Chain keywords by window key; inserting backwards keeps each chain in index order
+    for (int i = n - 1; i >= 0; i--) {
+        int w = lits_window(lits->off[i + 1] - lits->off[i]);
+        uint32_t key = lits_key(lits_hash((const unsigned char *)lits->bytes + lits->off[i], w), w);
+        uint64_t m = lits_mix(key);
+        used[lits_bucket(w)] = 1;
+        lits->filter[m >> lits->fshift] |= lits_bits(m);
+        for (int s = (int)((m >> 32) & (uint32_t)lits->mask); ; s = (s + 1) & lits->mask) {
+            uint64_t slot = lits->slots[s];
+            if (slot == 0 || (uint32_t)(slot >> 32) == key) {
+                lits->next[i] = (int)(uint32_t)slot - 1;
+                lits->slots[s] = (uint64_t)key << 32 | (uint32_t)(i + 1);
+                break;
+            }
+        }
+    }
+
+    // Windows in use, narrowest first (matches at one position come out shortest first)
+    static const int widths[TRE_LITS_BUCKETS] = { 1, 2, 3, 4, 8, 16, 32 };
+    for (int b = 0; b < TRE_LITS_BUCKETS; b++) {
+        if (!used[b]) continue;
+        uint32_t pw = 1;
+        for (int i = 1; i < widths[b]; i++) pw *= TRE_LITS_BASE;
+        lits->window[lits->nbuckets] = widths[b];
+        lits->pow[lits->nbuckets++] = pw;
+    }
+    return 0;
+}
+
+/* Report the keywords whose window at s has table key key; returns nonzero to stop */
+static int lits_probe(const tre_lits_t *lits, const char *text, int textlen, int s, uint32_t key, uint64_t m,
+                      tre_lit_fn fn, void *user, int *count)
+{
+    for (int sl = (int)((m >> 32) & (uint32_t)lits->mask); lits->slots[sl]; sl = (sl + 1) & lits->mask) {
+        if ((uint32_t)(lits->slots[sl] >> 32) != key) continue;
+        for (int k = (int)(uint32_t)lits->slots[sl] - 1; k >= 0; k = lits->next[k]) {
+            int len = lits->off[k + 1] - lits->off[k];
+            if (len > textlen - s || memcmp(text + s, lits->bytes + lits->off[k], (size_t)len) != 0) continue;
+            (*count)++;
+            if (fn && fn(k, text + s, len, user)) return 1;
+        }
+        break;
+    }
+    return 0;
+}
+
+int tre_lits_scan(const tre_lits_t *lits, const char *text, int textlen, tre_lit_fn fn, void *user)
+{
+    const unsigned char *t = (const unsigned char *)text;
+    const uint64_t *filter = lits->filter;
+    uint32_t h[TRE_LITS_BUCKETS], key[TRE_LITS_BLOCK * 8];
+    uint64_t cand[TRE_LITS_BLOCK * 8 / 64];
+    int count = 0;
+
+    for (int b = 0; b < lits->nbuckets; b++)
+        h[b] = lits->window[b] <= textlen ? lits_hash(t, lits->window[b]) : 0;
+    for (int s0 = 0; s0 < textlen; s0 += TRE_LITS_BLOCK) {
+        int e = (textlen - s0 < TRE_LITS_BLOCK) ? textlen : s0 + TRE_LITS_BLOCK;
+
+        // Roll each window over the block; windows passing the filter are marked at (s - s0) * 8 + b
+        memset(cand, 0, sizeof(cand));
+        for (int b = 0; b < lits->nbuckets; b++) {
+            int w = lits->window[b], last = (textlen - w + 1 < e) ? textlen - w + 1 : e;
+            uint32_t hb = h[b], pw = lits->pow[b];
+            int fshift = lits->fshift;
+            for (int s = s0; s < last; s++) {
+                if (s > 0) hb = (hb - t[s - 1] * pw) * TRE_LITS_BASE + t[s + w - 1];
+                uint32_t k = lits_key(hb, w);
+                uint64_t m = lits_mix(k), bits = lits_bits(m);
+                if ((filter[m >> fshift] & bits) == bits) {
+                    int at = (s - s0) * 8 + b;
+                    __builtin_prefetch(&lits->slots[(m >> 32) & (uint32_t)lits->mask]);
+                    key[at] = k;
+                    cand[at >> 6] |= (uint64_t)1 << (at & 63);
+                }
+            }
+            h[b] = hb;
+        }
+
+        // Confirm them in text order, narrowest window first
+        for (int i = 0; i < TRE_LITS_BLOCK * 8 / 64; i++)
+            for (uint64_t c = cand[i]; c; c &= c - 1) {
+                int at = i * 64 + __builtin_ctzll(c);
+                if (lits_probe(lits, text, textlen, s0 + at / 8, key[at], lits_mix(key[at]), fn, user, &count))
+                    return count;
+            }
+    }
+    return count;
+}
+
+// ─────────────────────────────────────────────────────
+// Pattern sets: parallel compilation into one arena,
+// identical patterns and class bitmaps stored once
+//
+//   [programs][pattern copies][class pool] ...
+//   [temporary: hash tables, per-thread class scratch, per-pattern info]
+//
+// Large keyword sets skip the programs: [pattern copies][keyword index]
+// ─────────────────────────────────────────────────────
+typedef struct {
+    tre_counts_t cnt;
+    uint64_t hash;               // of the pattern text
+    int size;                    // hot block bytes without class bitmaps
+    int cold;                    // pattern copy bytes
+    int err;
+    int same_as;                 // pattern whose program this one uses (itself if distinct)
+    int offset;                  // program offset in the arena
+    int cold_offset;             // pattern copy offset in the arena
+} tre_set_info_t;
+
+typedef struct {
+    const char *const *patterns;
+    int n, flags, nthreads;
+    tre_set_info_t *info;
+    unsigned char *base;         // arena
+    unsigned char (*pool)[32];   // interned class bitmaps
+    int npool;
+    int *pool_slots;             // hash table over pool, -1 = empty
+    int pool_mask;
+    unsigned char *scratch;      // per-thread class bitmaps, maxcls each
+    int maxcls;
+    int next;                    // next pattern to hand out
+#ifdef TRE_THREADS
+    pthread_mutex_t lock;
+#endif
+} tre_set_ctx_t;
+
+typedef void (*set_job_fn)(tre_set_ctx_t *ctx, int i, int worker);
+
+typedef struct {
+    tre_set_ctx_t *ctx;
+    set_job_fn job;
+    int worker;
+} tre_set_worker_t;
+
+#define TRE_SET_CHUNK  32        // patterns taken per grab
+
+static void *set_worker(void *arg)
+{
+    tre_set_worker_t *w = (tre_set_worker_t *)arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&w->ctx->next, TRE_SET_CHUNK, __ATOMIC_RELAXED);
+        if (i >= w->ctx->n) break;
+        int stop = (i + TRE_SET_CHUNK < w->ctx->n) ? i + TRE_SET_CHUNK : w->ctx->n;
+        for (; i < stop; i++) w->job(w->ctx, i, w->worker);
+    }
+    return NULL;
+}
+
+/* Run job for every pattern on ctx->nthreads threads (this one included) */
+static void set_run(tre_set_ctx_t *ctx, set_job_fn job)
+{
+    tre_set_worker_t self = { ctx, job, 0 };
+    ctx->next = 0;
+#ifdef TRE_THREADS
+    pthread_t tid[64];
+    tre_set_worker_t workers[64];
+    int started = 0;
+    for (int t = 1; t < ctx->nthreads && t < 64; t++) {
+        workers[t] = (tre_set_worker_t){ ctx, job, t };
+        if (pthread_create(&tid[t], NULL, set_worker, &workers[t]) != 0) break;
+        started = t;
+    }
+    set_worker(&self);
+    for (int t = 1; t <= started; t++) pthread_join(tid[t], NULL);
+#else
+    set_worker(&self);
+#endif
+}
+
+static void measure_one(const char *re, int flags, tre_set_info_t *in)
+{
+    in->err = re ? compile_pass(re, flags, NULL, NULL, &in->cnt) : TRE_ERROR_MALFORMED_PATTERN;
+    if (in->err != TRE_OK) return;
+    int len = (int)strlen(re);
+    in->hash = cache_hash(re, len);
+    in->size = hot_bytes(&in->cnt, flags, 0);
+    in->cold = len + 1;
+}
+
+static void set_measure(tre_set_ctx_t *ctx, int i, int worker)
+{
+    (void)worker;
+    measure_one(ctx->patterns[i], ctx->flags, &ctx->info[i]);
+}
+
+/* Bytes of the keyword index a large set of plain-text patterns gets, else 0 */
+static int set_lits_bytes(const char *const *patterns, int n, int flags)
+{
+    if ((flags & TRE_IGNCASE) || n < TRE_SET_LITERAL_MIN) return 0;
+    for (int i = 0; i < n; i++)
+        if (!patterns[i] || !patterns[i][0] || strpbrk(patterns[i], "\\^$.[*+?{")) return 0;
+    int size = tre_lits_bytes(patterns, NULL, n);
+    return size < 0 ? 0 : 15 + TRE_ALIGN((int)sizeof(tre_lits_t)) + size;
+}
+
+/* Temporary bytes at the end of the arena: info, pattern and class hash tables, scratch */
+static int set_temp_bytes(int n, int ncls, int maxcls, int nthreads)
+{
+    return TRE_ALIGN(n * (int)sizeof(tre_set_info_t)) + pow2_at_least(2 * n) * (int)sizeof(int)
+         + pow2_at_least(2 * ncls + 1) * (int)sizeof(int) + nthreads * maxcls * 32;
+}
+
+static uint64_t class_hash(const unsigned char *bits)
+{
+    uint64_t w[4];
+    memcpy(w, bits, 32);
+    uint64_t h = (w[0] * 0x9e3779b97f4a7c15ULL) ^ (w[1] * 0xc2b2ae3d27d4eb4fULL)
+               ^ (w[2] * 0x165667b19e3779f9ULL) ^ (w[3] * 0xd6e8feb86659fd93ULL);
+    return h ^ (h >> 31);
+}
+
+/* Stored copy of a class bitmap, added to the pool if new */
+static const unsigned char *set_intern(tre_set_ctx_t *ctx, const unsigned char *bits)
+{
+    for (int s = (int)(class_hash(bits) & (uint64_t)ctx->pool_mask); ; s = (s + 1) & ctx->pool_mask) {
+        int k = ctx->pool_slots[s];
+        if (k < 0) {
+            memcpy(ctx->pool[ctx->npool], bits, 32);
+            ctx->pool_slots[s] = ctx->npool;
+            return ctx->pool[ctx->npool++];
+        }
+        if (memcmp(ctx->pool[k], bits, 32) == 0) return ctx->pool[k];
+    }
+}
+
+static void set_build(tre_set_ctx_t *ctx, int i, int worker)
+{
+    tre_set_info_t *in = &ctx->info[i];
+    if (in->same_as != i) return;
+    unsigned char (*cls)[32] = (unsigned char (*)[32])(ctx->scratch + (size_t)worker * ctx->maxcls * 32);
+    tre_prog_t *prog = compile_into(ctx->patterns[i], ctx->flags, &in->cnt, ctx->base + in->offset,
+                                    in->size + in->cold, cls, (char *)ctx->base + in->cold_offset);
+
+    // Point class instructions at the shared copies
+#ifdef TRE_THREADS
+    pthread_mutex_lock(&ctx->lock);
+#endif
+    for (tre_inst_t *pc = prog->inst; pc->op != TRE_OP_END; pc++)
+        if (pc->op == TRE_OP_CLASS && pc->set >= cls[0] && pc->set < cls[0] + ctx->maxcls * 32)
+            pc->set = set_intern(ctx, pc->set);
+#ifdef TRE_THREADS
+    pthread_mutex_unlock(&ctx->lock);
+#endif
+    prog->ncls = 0;              // bitmaps live in the set's pool
+}
+
+/*
+ * Plan the arena: find duplicate patterns, place the programs and the class pool
+ * at the start and the temporary tables at the end. Returns the bytes needed.
+ */
+static int set_layout(tre_set_ctx_t *ctx, int memsize)
+{
+    int n = ctx->n, total = 0, cold = 0, ncls = 0;
+    int nslots = pow2_at_least(2 * n);
+    int *slots = (int *)((unsigned char *)ctx->info) - nslots;
+
+    for (int s = 0; s < nslots; s++) slots[s] = -1;
+    ctx->maxcls = 0;
+    for (int i = 0; i < n; i++) {
+        tre_set_info_t *in = &ctx->info[i];
+        in->same_as = i;
+        for (int s = (int)(in->hash & (uint64_t)(nslots - 1)); ; s = (s + 1) & (nslots - 1)) {
+            if (slots[s] < 0) { slots[s] = i; break; }
+            if (ctx->info[slots[s]].hash == in->hash && strcmp(ctx->patterns[slots[s]], ctx->patterns[i]) == 0) {
+                in->same_as = slots[s];
+                break;
+            }
+        }
+        if (in->same_as != i) continue;
+        in->offset = total;
+        total += in->size;
+        cold += in->cold;
+        ncls += in->cnt.ncls;
+        if (in->cnt.ncls > ctx->maxcls) ctx->maxcls = in->cnt.ncls;
+    }
+
+    int need = total + cold + ncls * 32 + set_temp_bytes(n, ncls, ctx->maxcls, ctx->nthreads);
+    if (need > memsize) return need;
+
+    // Pattern copies after all hot blocks, so the programs sit back to back
+    for (int i = 0, at = total; i < n; i++)
+        if (ctx->info[i].same_as == i) {
+            ctx->info[i].cold_offset = at;
+            at += ctx->info[i].cold;
+        }
+
+    int pool_slots = pow2_at_least(2 * ncls + 1);
+    ctx->pool = (unsigned char (*)[32])(ctx->base + total + cold);
+    ctx->npool = 0;
+    ctx->pool_mask = pool_slots - 1;
+    ctx->pool_slots = slots - pool_slots;
+    for (int s = 0; s < pool_slots; s++) ctx->pool_slots[s] = -1;
+    ctx->scratch = (unsigned char *)ctx->pool_slots - ctx->nthreads * ctx->maxcls * 32;
+    return need;
+}
+
+/* Measure all patterns; returns the index of the first bad one, or -1 */
+static int set_prepare(tre_set_ctx_t *ctx, const char *const *patterns, int n, int flags, int nthreads,
+                       void *mem, int memsize)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->patterns = patterns;
+    ctx->n = n;
+    ctx->flags = flags;
+    ctx->nthreads = (nthreads < 1) ? 1 : (nthreads > 64 ? 64 : nthreads);
+    ctx->base = (unsigned char *)mem + ((64 - ((size_t)mem & 63)) & 63);
+    ctx->info = (tre_set_info_t *)(ctx->base + memsize - TRE_ALIGN(n * (int)sizeof(tre_set_info_t)));
+    set_run(ctx, set_measure);
+    for (int i = 0; i < n; i++)
+        if (ctx->info[i].err != TRE_OK) {
+            tre_last_error = ctx->info[i].err;
+            return i;
+        }
+    return -1;
+}
+
+/* Keyword sets: NUL-terminated pattern copies, then the index; no programs */
+static int set_literal_bytes(const char *const *patterns, int n, int lits_bytes)
+{
+    int total = 0;
+    for (int i = 0; i < n; i++) total += (int)strlen(patterns[i]) + 1;
+    return 63 + total + lits_bytes;
+}
+
+/* Arena tail TRE_SET_REDUCE needs: the covered_by array, then tre_subsumes() work */
+static int set_reduce_bytes(int n)
+{
+    return 16 + TRE_ALIGN(n * (int)sizeof(int)) + TRE_SET_REDUCE_WORK;
+}
+
+int tre_set_size(const char *const *patterns, int n, int flags, int nthreads)
+{
+    tre_last_error = TRE_OK;
+    if (!patterns || n <= 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    int reduce = flags & TRE_SET_REDUCE;
+    flags &= ~TRE_SET_REDUCE;
+    int lits_bytes = set_lits_bytes(patterns, n, flags);
+    if (lits_bytes) {
+        for (int i = 0; i < n; i++) {
+            tre_counts_t cnt;
+            int err = compile_pass(patterns[i], flags, NULL, NULL, &cnt);
+            if (err != TRE_OK) {
+                tre_last_error = err;
+                return -1;
+            }
+        }
+        return set_literal_bytes(patterns, n, lits_bytes);
+    }
+    if (nthreads < 1)  nthreads = 1;
+    if (nthreads > 64) nthreads = 64;
+
+    // Worst case: no pattern or class shared
+    int total = 0, ncls = 0, maxcls = 0;
+    for (int i = 0; i < n; i++) {
+        tre_set_info_t in;
+        measure_one(patterns[i], flags, &in);
+        if (in.err != TRE_OK) {
+            tre_last_error = in.err;
+            return -1;
+        }
+        total += in.size + in.cold;
+        ncls += in.cnt.ncls;
+        if (in.cnt.ncls > maxcls) maxcls = in.cnt.ncls;
+    }
+    int temp = set_temp_bytes(n, ncls, maxcls, nthreads);
+    if (reduce && temp < set_reduce_bytes(n)) temp = set_reduce_bytes(n);   // both use the free tail
+    return 63 + total + ncls * 32 + temp;   // + alignment
+}
+
+/*
+ * Large keyword sets: only the pattern copies and the keyword index are stored.
+ * Pattern i is at literals + lits->off[i] + i; tre_set_prog() compiles it on demand.
+ */
+static int set_compile_literal(tre_set_t *set, const char *const *patterns, int n,
+                               tre_prog_t **progs, void *mem, int memsize, int lits_bytes)
+{
+    for (int i = 0; i < n; i++) {
+        tre_counts_t cnt;
+        int err = compile_pass(patterns[i], set->flags, NULL, NULL, &cnt);
+        if (err != TRE_OK) {
+            set->failed = i;
+            tre_last_error = err;
+            return -1;
+        }
+    }
+    if (set_literal_bytes(patterns, n, lits_bytes) - 63 > memsize) {
+        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+        return -1;
+    }
+
+    char *text = (char *)mem + ((64 - ((size_t)mem & 63)) & 63), *at = text;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(patterns[i]) + 1;
+        memcpy(at, patterns[i], len);
+        at += len;
+        progs[i] = NULL;
+    }
+    tre_lits_t *lits = (tre_lits_t *)(at + ((16 - ((size_t)at & 15)) & 15));
+    unsigned char *idx = (unsigned char *)lits + TRE_ALIGN((int)sizeof(tre_lits_t));
+    if (tre_lits_init(lits, patterns, NULL, n, idx, (int)((unsigned char *)at + lits_bytes - idx)) != 0)
+        return -1;
+
+    set->n = n;
+    set->progs = progs;
+    set->lits = lits;
+    set->literals = text;
+    set->used = (int)(idx + lits->used - (unsigned char *)mem);
+    tre_last_error = TRE_OK;
+    return 0;
+}
+
+int tre_set_compile(tre_set_t *set, const char *const *patterns, int n, int flags,
+                    tre_prog_t **progs, void *mem, int memsize, int nthreads)
+{
+    tre_set_ctx_t ctx;
+
+    tre_last_error = TRE_OK;
+    TRE_PROF_FORGET();
+    memset(set, 0, sizeof(*set));
+    set->failed = -1;
+    if (!patterns || n <= 0 || !progs || !mem) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    int reduce = flags & TRE_SET_REDUCE;
+    flags &= ~TRE_SET_REDUCE;
+    set->flags = flags;
+    int lits_bytes = set_lits_bytes(patterns, n, flags);
+    if (memsize < (lits_bytes ? 64 : TRE_ALIGN(n * (int)sizeof(tre_set_info_t)) + 64)) {
+        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+        return -1;
+    }
+    memsize -= (int)(((64 - ((size_t)mem & 63)) & 63));
+    memsize &= ~15;
+    if (lits_bytes) return set_compile_literal(set, patterns, n, progs, mem, memsize, lits_bytes);
+
+    set->failed = set_prepare(&ctx, patterns, n, flags, nthreads, mem, memsize);
+    if (set->failed >= 0) return -1;
+    if (set_layout(&ctx, memsize) > memsize) {
+        tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+        return -1;
+    }
+
+#ifdef TRE_THREADS
+    pthread_mutex_init(&ctx.lock, NULL);
+#endif
+    set_run(&ctx, set_build);
+#ifdef TRE_THREADS
+    pthread_mutex_destroy(&ctx.lock);
+#endif
+
+    set->n = n;
+    set->progs = progs;
+    for (int i = 0; i < n; i++) {
+        tre_set_info_t *in = &ctx.info[i];
+        progs[i] = (tre_prog_t *)(ctx.base + ctx.info[in->same_as].offset);
+        if (in->same_as == i) {
+            set->programs++;
+            set->classes += in->cnt.ncls;
+        }
+    }
+    set->classes_stored = ctx.npool;
+    set->used = (int)(ctx.pool[ctx.npool] - (unsigned char *)mem);
+    if (reduce) {
+        // covered_by stays after the programs; tre_subsumes() works in what is left
+        int off = TRE_ALIGN((int)(ctx.pool[ctx.npool] - ctx.base));
+        int *covered = (int *)(ctx.base + off);
+        int at = off + TRE_ALIGN(n * (int)sizeof(int));
+        if (at > memsize) {
+            tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+            return -1;
+        }
+        tre_set_reduce(set, covered, ctx.base + at, memsize - at);
+        set->covered_by = covered;
+        set->used = (int)(ctx.base + off - (unsigned char *)mem) + n * (int)sizeof(int);
+    }
+    return 0;
+}
+
+int tre_set_prog_size(const tre_set_t *set, int i)
+{
+    tre_last_error = TRE_OK;
+    if (!set || i < 0 || i >= set->n) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    if (set->progs[i]) return 0;
+    return tre_compile_size(set->literals + set->lits->off[i] + i, set->flags);
+}
+
+tre_prog_t *tre_set_prog(const tre_set_t *set, int i, void *mem, int memsize)
+{
+    if (tre_set_prog_size(set, i) < 0) return NULL;
+    if (set->progs[i]) return set->progs[i];
+    return tre_compile(set->literals + set->lits->off[i] + i, set->flags, mem, memsize);
+}
+
+/* Mark a keyword found by the set's index */
+static int set_mark(int keyword, const char *match, int matchlen, void *user)
+{
+    (void)match; (void)matchlen;
+    unsigned char *matched = (unsigned char *)user;
+    matched[keyword >> 3] |= (unsigned char)(1 << (keyword & 7));
+    return 0;
+}
+
+int tre_set_match(const tre_set_t *set, const char *text, int textlen, unsigned char *matched)
+{
+    int count = 0;
+    tre_last_error = TRE_OK;
+    if (!set || !set->progs || !text || textlen < 0 || !matched) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    memset(matched, 0, (size_t)(set->n + 7) / 8);
+    if (set->lits) {
+        tre_lits_scan(set->lits, text, textlen, set_mark, matched);
+        for (int i = 0; i < (set->n + 7) / 8; i++) count += __builtin_popcount(matched[i]);
+        return count;
+    }
+    // Kept patterns first; a covered one cannot match where its cover did not
+    for (int pass = 0; pass < (set->covered_by ? 2 : 1); pass++) {
+        for (int i = 0; i < set->n; i++) {
+            if (set->covered_by) {
+                int by = set->covered_by[i];
+                if ((by >= 0) != pass || (by >= 0 && !(matched[by >> 3] & (1 << (by & 7))))) continue;
+            }
+            if (tre_execn(set->progs[i], text, textlen, NULL, 1)) {
+                matched[i >> 3] |= (unsigned char)(1 << (i & 7));
+                count++;
+            } else if (tre_last_error != TRE_ERROR_NO_MATCH) {
+                return -1;
+            }
+        }
+    }
+    tre_last_error = TRE_OK;
+    return count;
+}
+
+// ─────────────────────────────────────────────────────
+// Subsumption: does every text one program matches also
+// match another? Decided on the unit automata of both,
+// walked together over all texts (a product search)
+//
+// A state pairs the unit sets of a and b; a witness is a
+// text end where a has matched and b has not. Once b has
+// matched it stays matched, so such branches are cut.
+// ─────────────────────────────────────────────────────
+
+#define TRE_SUB_DFA_BYTES   ((int)sizeof(tre_dfa_t) + 255 * (int)sizeof(tre_dfa_class_t))
+#define TRE_PROD_FIRST      1            // at the start of the text
+#define TRE_PROD_WORD       2            // previous byte is a word byte
+#define TRE_SUB_MATCHED_A   4            // a has matched earlier in the text
+
+typedef struct {
+    uint64_t a, b;                       // unit sets, before the zero-width closure
+    unsigned flags;
+} tre_sub_state_t;
+
+/* The program's automaton, built into mem (TRE_SUB_DFA_BYTES) if it has none */
+static const tre_dfa_t *prod_dfa_build(const tre_prog_t *prog, void *mem)
+{
+    build_dfa((tre_prog_t *)prog, mem);
+    return mem;
+}
+
+/* The program's automaton, built into mem if it has none; NULL if too many units */
+static const tre_dfa_t *sub_dfa(const tre_prog_t *prog, void *mem)
+{
+    if (prog->dfa) return prog->dfa;
+    int units = 0;
+    for (const tre_inst_t *in = prog->inst; in->op != TRE_OP_END; in++)
+        if ((units += inst_units(in)) > TRE_DFA_MAX_UNITS) return NULL;
+    return prod_dfa_build(prog, mem);
+}
+
+/* Zero-width closure before byte c (c < 0: end of text); sets *matched */
+static uint64_t prod_close(const tre_dfa_t *dfa, int anchored, uint64_t d, unsigned flags, int c, int *matched)
+{
+    if (!anchored || (flags & TRE_PROD_FIRST)) d |= 1;
+    uint64_t s = dfa->fwd.skip;
+    if (c >= 0) s |= dfa->fwd.look & dfa->cls[dfa->map[c]].fwd;
+    if (dfa->bounds) {
+        int before = !(flags & TRE_PROD_FIRST) && (flags & TRE_PROD_WORD);
+        int after = c >= 0 && TRE_INTABLE(tre_class_word, c);
+        s |= (before != after) ? dfa->fwd.wordb : dfa->fwd.nwordb;
+    }
+    d = TRE_DFA_CLOSE(d, s);
+    *matched = ((d >> dfa->m) & 1) && (!dfa->eol || c < 0);
+    return d;
+}
+
+static int sub_visit(tre_sub_state_t *states, int *table, int mask, int *n, int cap, const tre_sub_state_t *st)
+{
+    uint64_t h = (st->a * 0x9e3779b97f4a7c15ULL) ^ (st->b * 0xd6e8feb86659fd93ULL) ^ st->flags;
+    h ^= h >> 29;
+    for (int s = (int)(h & (uint64_t)mask); ; s = (s + 1) & mask) {
+        if (table[s] < 0) {
+            if (*n == cap) return -1;           // out of room: undecided
+            states[*n] = *st;
+            table[s] = (*n)++;
+            return 1;
+        }
+        const tre_sub_state_t *o = &states[table[s]];
+        if (o->a == st->a && o->b == st->b && o->flags == st->flags) return 0;
+    }
+}
+
+int tre_subsumes(const tre_prog_t *a, const tre_prog_t *b, void *work, int worksize)
+{
+    unsigned char *w = (unsigned char *)(((uintptr_t)work + 15) & ~(uintptr_t)15);
+    int room = worksize - (int)(w - (unsigned char *)work) - 2 * TRE_SUB_DFA_BYTES;
+    if (!a || !b || !work || room < 64 * (int)(sizeof(tre_sub_state_t) + 2 * sizeof(int))) return -1;
+    if (a == b) return 1;
+
+    const tre_dfa_t *da = sub_dfa(a, w), *db = sub_dfa(b, w + TRE_SUB_DFA_BYTES);
+    if (!da || !db) return -1;
+
+    int cap = room / (int)(sizeof(tre_sub_state_t) + 2 * sizeof(int)), slots = 1;
+    while (slots * 2 <= 2 * cap) slots *= 2;
+    tre_sub_state_t *states = (tre_sub_state_t *)(w + 2 * TRE_SUB_DFA_BYTES);
+    int *table = (int *)(states + cap);
+    for (int i = 0; i < slots; i++) table[i] = -1;
+
+    // One representative byte per combination of a's class, b's class and word-ness
+    unsigned char reps[256];
+    int nreps = 0;
+    for (int c = 0; c < 256; c++) {
+        int r = 0;
+        while (r < nreps && !(da->map[reps[r]] == da->map[c] && db->map[reps[r]] == db->map[c]
+                              && TRE_INTABLE(tre_class_word, reps[r]) == TRE_INTABLE(tre_class_word, c))) r++;
+        if (r == nreps) reps[nreps++] = (unsigned char)c;
+    }
+
+    int n = 0;
+    tre_sub_state_t start = { 0, 0, TRE_PROD_FIRST };
+    sub_visit(states, table, slots - 1, &n, cap, &start);
+    for (int i = 0; i < n; i++) {
+        const tre_sub_state_t st = states[i];
+        int ma, mb;
+
+        // End the text here: a witness if a matched and b does not
+        prod_close(da, a->anchored, st.a, st.flags, -1, &ma);
+        prod_close(db, b->anchored, st.b, st.flags, -1, &mb);
+        if ((ma || (st.flags & TRE_SUB_MATCHED_A)) && !mb) return 0;
+
+        for (int r = 0; r < nreps; r++) {
+            int c = reps[r];
+            tre_sub_state_t next;
+            uint64_t xa = prod_close(da, a->anchored, st.a, st.flags, c, &ma);
+            uint64_t xb = prod_close(db, b->anchored, st.b, st.flags, c, &mb);
+            if (mb) continue;                    // b matched: every longer text matches b too
+            next.flags = (st.flags & TRE_SUB_MATCHED_A) | (ma ? TRE_SUB_MATCHED_A : 0)
+                       | (TRE_INTABLE(tre_class_word, c) ? TRE_PROD_WORD : 0);
+            next.a = (next.flags & TRE_SUB_MATCHED_A) ? 0 : dfa_step(da, &da->fwd, 0, xa, (unsigned char)c);
+            next.b = dfa_step(db, &db->fwd, 0, xb, (unsigned char)c);
+            if (!next.a && a->anchored && !(next.flags & TRE_SUB_MATCHED_A)) continue;   // a can no longer match
+            if (sub_visit(states, table, slots - 1, &n, cap, &next) < 0) return -1;
+        }
+    }
+    return 1;
+}
+
+/* Keyword sets: a keyword covers every keyword that contains it */
+static void set_reduce_literal(const tre_set_t *set, int *subsumed_by)
+{
+    const tre_lits_t *lits = set->lits;
+    for (int i = 0; i < set->n; i++) {
+        subsumed_by[i] = -1;
+        const char *ki = set->literals + lits->off[i] + i;
+        int li = lits->off[i + 1] - lits->off[i];
+        for (int j = 0; j < set->n && subsumed_by[i] < 0; j++) {
+            int lj = lits->off[j + 1] - lits->off[j];
+            if (j == i || lj > li || (lj == li && j > i)) continue;   // of equal keywords the first stays
+            if (strstr(ki, set->literals + lits->off[j] + j)) subsumed_by[i] = j;
+        }
+    }
+}
+
+static void set_reduce_programs(const tre_set_t *set, int *subsumed_by, void *work, int worksize)
+{
+    for (int i = 0; i < set->n; i++) {
+        subsumed_by[i] = -1;
+        const tre_prog_t *pi = set->progs[i];
+        for (int j = 0; j < set->n && subsumed_by[i] < 0; j++) {
+            const tre_prog_t *pj = set->progs[j];
+            if (j == i) continue;
+            if (pj == pi) {                      // the same pattern: keep the first
+                if (j < i) subsumed_by[i] = j;
+                continue;
+            }
+            // b needs bytes a's matches are not known to contain: skip (may miss some, never wrong)
+            if ((pj->need[0] & ~pi->need[0]) | (pj->need[1] & ~pi->need[1]) |
+                (pj->need[2] & ~pi->need[2]) | (pj->need[3] & ~pi->need[3])) continue;
+            if (tre_subsumes(pi, pj, work, worksize) != 1) continue;
+            // Equivalent patterns: the first one stays
+            if (j > i && tre_subsumes(pj, pi, work, worksize) == 1) continue;
+            subsumed_by[i] = j;
+        }
+    }
+}
+
+int tre_set_reduce(tre_set_t *set, int *subsumed_by, void *work, int worksize)
+{
+    int kept = 0;
+    if (set->literals) set_reduce_literal(set, subsumed_by);
+    else               set_reduce_programs(set, subsumed_by, work, worksize);
+
+    // Point every dropped pattern at a kept one (subsumption is transitive)
+    for (int i = 0; i < set->n; i++) {
+        int r = i, steps = 0;
+        while (subsumed_by[r] >= 0 && steps++ < set->n) r = subsumed_by[r];
+        if (subsumed_by[r] >= 0) r = i;          // undecided pairs closed a loop: keep this one
+        subsumed_by[i] = (r == i) ? -1 : r;
+        kept += (r == i);
+    }
+    return kept;
+}
+
+// ─────────────────────────────────────────────────────
+// Boolean rules: the automata of several patterns run
+// as one product automaton, built lazily state by state
+// and cached in the rule's memory (a lazy DFA)
+//
+// A product state holds every pattern's unit set plus
+// the flags of prod_close(); a pattern that has matched
+// sets its bit in the flags and stops being tracked.
+// ─────────────────────────────────────────────────────
+
+#define TRE_BOOL_MATCHED(i)   (1u << (8 + (i)))
+#define TRE_BOOL_OPEN         (-1)       // outcome not known yet
+
+typedef struct {
+    uint64_t d[TRE_BOOL_MAX];
+    unsigned flags;
+    int      verdict;                    // 1, 0 or TRE_BOOL_OPEN
+} tre_bool_state_t;
+
+int tre_bool_init(tre_bool_t *rule, void *mem, int memsize)
+{
+    memset(rule, 0, sizeof(*rule));
+    if (!mem || memsize < 0) return -1;
+    rule->mem = (unsigned char *)(((uintptr_t)mem + 15) & ~(uintptr_t)15);
+    rule->memsize = memsize - (int)(rule->mem - (unsigned char *)mem);
+    return 0;
+}
+
+int tre_bool_add(tre_bool_t *rule, tre_prog_t *prog, int negate)
+{
+    if (!prog || rule->n == TRE_BOOL_MAX) return -1;
+    const tre_dfa_t *dfa = prog->dfa;
+    if (!dfa) {
+        int units = 0;
+        for (const tre_inst_t *in = prog->inst; in->op != TRE_OP_END && units <= TRE_DFA_MAX_UNITS; in++)
+            units += inst_units(in);
+        if (units <= TRE_DFA_MAX_UNITS) {
+            if (rule->used + TRE_SUB_DFA_BYTES > rule->memsize) return -1;
+            dfa = prod_dfa_build(prog, rule->mem + rule->used);
+            rule->used += TRE_SUB_DFA_BYTES;
+        }
+    }
+    rule->progs[rule->n] = prog;
+    rule->negate[rule->n] = (unsigned char)(negate != 0);
+    rule->dfa[rule->n] = dfa;
+    rule->n++;
+    rule->ready = 0;
+    return 0;
+}
+
+/* Product byte classes and the empty state cache in the memory left over */
+static int bool_layout(tre_bool_t *rule)
+{
+    unsigned char rep[256];
+    rule->nclass = 0;
+    for (int c = 0; c < 256; c++) {
+        int k;
+        for (k = 0; k < rule->nclass; k++) {
+            int same = TRE_INTABLE(tre_class_word, rep[k]) == TRE_INTABLE(tre_class_word, c);
+            for (int i = 0; i < rule->n && same; i++) {
+                const tre_dfa_t *dfa = rule->dfa[i];
+                same = !dfa || dfa->map[rep[k]] == dfa->map[c];
+            }
+            if (same) break;
+        }
+        if (k == rule->nclass) rep[rule->nclass++] = (unsigned char)c;
+        rule->map[c] = (unsigned char)k;
+    }
+
+    int room = rule->memsize - rule->used;
+    int per = (int)sizeof(tre_bool_state_t) + rule->nclass * (int)sizeof(int) + 2 * (int)sizeof(int);
+    rule->cap = room / per;
+    if (rule->cap < 2) return -1;
+    rule->nslots = 1;
+    while (rule->nslots * 2 <= 2 * rule->cap) rule->nslots *= 2;
+    rule->states = rule->mem + rule->used;
+    rule->trans = (int *)((tre_bool_state_t *)rule->states + rule->cap);
+    rule->slots = rule->trans + (size_t)rule->cap * rule->nclass;
+    rule->ready = 1;
+    return 0;
+}
+
+static void bool_flush(tre_bool_t *rule)
+{
+    rule->nstates = 0;
+    for (int i = 0; i < rule->nslots; i++) rule->slots[i] = -1;
+}
+
+/* What the state already decides: a negated pattern matched, a required one cannot, or all are settled */
+static int bool_verdict(const tre_bool_t *rule, const tre_bool_state_t *st)
+{
+    int open = 0;
+    for (int i = 0; i < rule->n; i++) {
+        const tre_dfa_t *dfa = rule->dfa[i];
+        if (!dfa) continue;                     // searched on its own afterwards
+        int matched = (st->flags & TRE_BOOL_MATCHED(i)) != 0;
+        int dead = !matched && rule->progs[i]->anchored && !(st->flags & TRE_PROD_FIRST) && st->d[i] == 0;
+        if (rule->negate[i]) {
+            if (matched) return 0;
+            if (!dead) open = 1;
+        } else {
+            if (dead) return 0;
+            if (!matched) open = 1;
+        }
+    }
+    return open ? TRE_BOOL_OPEN : 1;
+}
+
+/* Cached state id for st, adding it (and restarting a full cache) if new */
+static int bool_state(tre_bool_t *rule, const tre_bool_state_t *st)
+{
+    uint64_t h = st->flags;
+    for (int i = 0; i < rule->n; i++) h = (h ^ st->d[i]) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 31;
+    int mask = rule->nslots - 1;
+    tre_bool_state_t *states = rule->states;
+    for (int s = (int)(h & (uint64_t)mask); ; s = (s + 1) & mask) {
+        int id = rule->slots[s];
+        if (id < 0) break;
+        if (states[id].flags == st->flags && memcmp(states[id].d, st->d, sizeof(st->d)) == 0) return id;
+    }
+    if (rule->nstates == rule->cap) {
+        tre_bool_state_t copy = *st;            // st may live in the cache
+        bool_flush(rule);
+        rule->flushes++;
+        st = &copy;
+        return bool_state(rule, st);
+    }
+    int id = rule->nstates++;
+    states[id] = *st;
+    states[id].verdict = bool_verdict(rule, st);
+    for (int k = 0; k < rule->nclass; k++) rule->trans[(size_t)id * rule->nclass + k] = -1;
+    int s = (int)(h & (uint64_t)mask);
+    while (rule->slots[s] >= 0) s = (s + 1) & mask;
+    rule->slots[s] = id;
+    return id;
+}
+
+/* Close every tracked pattern before byte c (c < 0: end of text) and, for a byte, step over it */
+static void bool_advance(const tre_bool_t *rule, const tre_bool_state_t *st, int c, tre_bool_state_t *next)
+{
+    memset(next, 0, sizeof(*next));
+    next->flags = (st->flags & ~(unsigned)(TRE_PROD_FIRST | TRE_PROD_WORD))
+                | ((c >= 0 && TRE_INTABLE(tre_class_word, c)) ? TRE_PROD_WORD : 0);
+    for (int i = 0; i < rule->n; i++) {
+        const tre_dfa_t *dfa = rule->dfa[i];
+        if (!dfa || (st->flags & TRE_BOOL_MATCHED(i))) continue;
+        int matched;
+        uint64_t d = prod_close(dfa, rule->progs[i]->anchored, st->d[i], st->flags, c, &matched);
+        if (matched) next->flags |= TRE_BOOL_MATCHED(i);
+        else if (c >= 0) next->d[i] = dfa_step(dfa, &dfa->fwd, 0, d, (unsigned char)c);
+    }
+}
+
+int tre_bool_exec(tre_bool_t *rule, const char *text, int textlen)
+{
+    if (!rule || !text || textlen < 0 || rule->n == 0) {
+        tre_last_error = TRE_ERROR_MALFORMED_PATTERN;
+        return -1;
+    }
+    if (!rule->ready) {
+        if (bool_layout(rule) < 0) {
+            tre_last_error = TRE_ERROR_PATTERN_TOO_LONG;
+            return -1;
+        }
+        bool_flush(rule);
+    }
+
+    tre_bool_state_t st, next;
+    memset(&st, 0, sizeof(st));
+    st.flags = TRE_PROD_FIRST;
+    int cur = bool_state(rule, &st);
+    const tre_bool_state_t *states = rule->states;
+    const unsigned char *t = (const unsigned char *)text;
+    int verdict = states[cur].verdict;
+
+    // Cached transitions hold (next id << 2) | (its verdict + 1), -1 when not built yet
+    const int nclass = rule->nclass;
+    const unsigned char *map = rule->map;
+    int *trans = rule->trans;
+    for (int p = 0; p < textlen && verdict == TRE_BOOL_OPEN; p++) {
+        int *slot = &trans[(size_t)cur * nclass + map[t[p]]];
+        int e = *slot;
+        if (e >= 0) {
+            cur = e >> 2;
+            verdict = (e & 3) - 1;
+            continue;
+        }
+        bool_advance(rule, &states[cur], t[p], &next);
+        int flushes = rule->flushes;
+        cur = bool_state(rule, &next);
+        verdict = states[cur].verdict;
+        if (rule->flushes == flushes) *slot = (cur << 2) | (verdict + 1);   // the source state still exists
+    }
+    if (verdict == TRE_BOOL_OPEN) {             // end of text: what matched is all there is
+        bool_advance(rule, &states[cur], -1, &next);
+        verdict = 1;
+        for (int i = 0; i < rule->n; i++)
+            if (rule->dfa[i] && ((next.flags & TRE_BOOL_MATCHED(i)) != 0) == rule->negate[i]) verdict = 0;
+    }
+
+    // Patterns without an automaton: one search each, only if the product still says yes
+    for (int i = 0; i < rule->n && verdict == 1; i++) {
+        if (rule->dfa[i]) continue;
+        int len;
+        char *m = tre_execn(rule->progs[i], text, textlen, &len, 1);
+        if (!m && tre_last_error != TRE_ERROR_NO_MATCH) return -1;
+        if ((m != NULL) == rule->negate[i]) verdict = 0;
+    }
+    tre_last_error = TRE_OK;
+    return verdict;
+}